@@ -1,50 +1,776 @@
+// Build: mpicc -O3 -march=native -fopenmp -pthread -DNDEBUG game_of_life.c -o life.x -lm
+// -DNDEBUG is the release switch: it strips the asserts out of next_value();
+// leave it off while debugging. Without -fopenmp each rank runs one thread.
+//
+// Hybrid runs use one rank per node or socket and a thread per core, e.g.
+//   OMP_NUM_THREADS=8 mpirun --map-by socket --bind-to socket -np 2 ./life.x 100
+// Threads are pinned to the cores the rank is bound to unless OMP_PROC_BIND
+// already says otherwise.
+
+#define _GNU_SOURCE
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
+#include<strings.h>
+#include<stdint.h>
+#include<getopt.h>
+#include<limits.h>
+#include<math.h>
 #include<assert.h>
+#include<sched.h>
+#include<pthread.h>
 #include<mpi.h>
+#ifdef _OPENMP
+#include<omp.h>
+#else
+int omp_get_thread_num(void) { return 0; }
+int omp_get_num_threads(void) { return 1; }
+int omp_get_max_threads(void) { return 1; }
+void omp_set_num_threads(int n) { (void) n; }
+#endif
+
+// Boards are stored bit-packed: 64 cells per uint64_t word, cell [r][c] is
+// bit (c % 64) of word (c / 64) in row r. Every local row carries at least
+// one guard word on each side that holds the neighbouring rank's edge word
+// (zero at the board edge) and bits past the last column are kept zero, so
+// the kernels never need to special-case the board edges.
+#define CELLS_PER_WORD 64
+#define GUARD_WORDS 2
+
+// Deep halos: with a halo depth of k each rank keeps k ghost rows on each
+// side (k * R for a rule of radius R) and exchanges them once every k
+// generations, recomputing the still-exact part of the ghost zone locally
+// in between. A single ghost word loses R exact cells per generation from
+// its far end, so it covers up to 64 / R generations as long as there is a
+// spare guard word beyond it.
+#define MAX_HALO_DEPTH 64
+#define TUNE_ROUNDS 20
+
+// Active tiles: with --active the local board is cut into tiles of
+// TILE_ROWS x TILE_WORDS and a tile is only recomputed when it or one of
+// its eight neighbours changed in the previous generation. A skipped tile
+// needs no copy, the other board already holds the same cells.
+#define TILE_ROWS 16
+#define TILE_WORDS 4
+
+struct tiles {
+    int rows, columns;                  // tile grid over the stored board
+    uint8_t* changed;                   // changed in the last generation
+    uint8_t* next;                      // changed in the generation being computed
+    uint8_t* dirty;                     // changed since the last halo exchange
+};
+
+// The board is split into a 2D grid of blocks, one per rank. Block rows
+// are whole board rows, block columns are whole packed words. Local boards
+// are stored with halo_rows ghost rows above and below and halo_words
+// ghost words left and right of the owned block.
+struct domain {
+    MPI_Comm cart;                      // dims[0] x dims[1] process grid
+    MPI_Comm row_comm;                  // ranks in my process row
+    MPI_Comm col_comm;                  // ranks in my process column
+    int dims[2], coords[2];
+    int nbr[3][3];                      // neighbour ranks by [row offset + 1][column offset + 1]
+    int rows, columns, words;           // whole board
+    int local_rows, local_words;        // my block
+    int row_start, word_start;
+    int depth, radius;                  // generations per exchange, rule radius
+    int halo_rows, halo_words;          // ghost rows (depth * radius), ghost + spare guard words
+    int pitch;                          // local_words + 2 * halo_words
+    int last_word;                      // stored index of the board's last word, or -1
+    uint64_t last_mask;                 // valid bits of that word
+    MPI_Datatype column;                // one word of each owned row
+    MPI_Datatype halo_type[3][3];       // ghost zone shared with each neighbour
+    struct tiles* tiles;                // NULL unless tracking active tiles
+    struct shared* shared;              // NULL unless sharing boards on the node
+};
+
+// a rectangle of a local board: rows [row_begin, row_end) and words
+// [word_begin, word_end), counted in stored rows and words
+struct region {
+    int row_begin, row_end, word_begin, word_end;
+};
 
 // Read initial board from stdin or file (via redirect) and return pointer to it
 // File format will be:
 // #rows #columns
 // Followed by each row in the format: 001110100
 // Board will be rectangular, but not necessarily square
-// Returns the board (as a 1D array laid out in row-major order),
-//   and populates the rows and columns variables
-int* get_initial_board(int* rows, int* columns);
-void write_board(int* board, int rows, int columns); // write board to stdout
+// Returns the board (packed, rows * words_per_row(columns) words laid out in
+//   row-major order), and populates the rows and columns variables
+uint64_t* get_initial_board(int* rows, int* columns);
+void write_board(uint64_t* board, int rows, int columns); // write board to stdout
+
+// Binary boards (--input): a 32-byte header followed by the packed board
+// exactly as get_initial_board() lays it out, rows * words_per_row(columns)
+// little-endian uint64_t words. life_convert.c writes them from the text
+// format. Every rank reads its own block with MPI-IO, so no rank ever
+// holds the whole board.
+#define BOARD_MAGIC "LIFEPACK"
+#define BOARD_ENCODING_PACKED64 1
+struct board_header {
+    char magic[8];
+    uint32_t encoding;
+    uint32_t reserved;
+    uint64_t rows, columns;
+};
+
+// open a binary board collectively on comm and read its size; aborts on
+// anything that is not a board this program can hold
+MPI_File open_board_file(MPI_Comm comm, const char* path, int* rows, int* columns);
+
+// create a binary board file collectively on comm, header included
+MPI_File create_board_file(MPI_Comm comm, const char* path, int rows, int columns);
+
+// Patterns (--pattern): the standard RLE format, or Life 1.06 cell lists.
+// Every rank parses its own slice of the file and the live runs it finds
+// go straight to the ranks that own them, so the dense board is never
+// built anywhere.
+struct run {
+    int row, column, length;            // length live cells from [row][column]
+};
+struct pattern {
+    int rows, columns;                  // bounding box
+    struct run* runs;                   // the runs this rank parsed, pattern coordinates
+    int count;
+};
+#define PATTERN_RLE 0
+#define PATTERN_LIFE_106 1
+
+// parse a pattern file collectively on comm. The rule in an RLE header
+// has to be one parse_rule() reads; if it is not the current rule, rank 0
+// warns and --rule wins.
+void read_pattern(MPI_Comm comm, const char* path, struct pattern* p);
+void free_pattern(struct pattern* p);
+
+// the text writer formats whole rows and hands stdout buffers this big
+#define OUTPUT_BUFFER (4 << 20)
+
+// simulate 1 generation for region r of a packed local board with pitch
+// words per row, using bitwise full adders, 64 cells at a time. Every row
+// and word of r needs a readable row or word on each side of it. If
+// last_word lies in r it is trimmed with last_mask.
+void generation(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                int last_word, uint64_t last_mask);
+
+// same contract as generation(), one byte per cell: rows are unpacked into
+// a rolling three-row window, interior columns go through a branch-free
+// stencil the compiler can vectorize, and only the first and last columns,
+// whose neighbours sit outside the window, take the count_neighbors() path
+void generation_stencil(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                        int last_word, uint64_t last_mask);
+
+typedef void (*life_kernel)(uint64_t*, uint64_t*, int, struct region, int, uint64_t);
 
-// simulate 1 generation
-void generation(int* new_board, int* old_board, int rows, int columns);
+// Outer-totalistic rules (--rule, --radius): a dead cell is born, or a
+// live one survives, when its number of live neighbours is in the rule's
+// birth or survival set. The neighbours are the other cells of the square
+// of radius R around it. Rules are written B<counts>/S<counts>, the counts
+// as digits for radius 1 (B36/S23) or as comma-separated numbers and
+// ranges (B34-45/S34-58). The radius is bounded by the tile height so
+// active tiles still only look at their eight neighbours.
+#define LIFE_RULE "B3/S23"
+#define MAX_RADIUS TILE_ROWS
+#define MAX_NEIGHBORS ((2 * MAX_RADIUS + 1) * (2 * MAX_RADIUS + 1) - 1)
+struct rule {
+    const char* text;                   // as given, for messages
+    int radius;
+    uint32_t birth, survive;            // radius 1: bit n is set for n neighbours
+    uint32_t table;                     // radius 1: bit (alive * 16 + n) is the next state
+    uint8_t next[2][MAX_NEIGHBORS + 1]; // next state by [alive][neighbours]
+};
+static struct rule rule;                // set once, before the first generation
 
-// return # neighbors of cell [row][column]
-int count_neighbors(int* board, int r, int c, int rows, int columns);
+// read B/S notation for the given radius; 0 if it is not a rule
+int parse_rule(const char* text, int radius, struct rule* r);
 
-// given # of neighbors and current value, return next value
+// the bitwise kernel for a radius 1 rule: one compiled for its birth and
+// survival masks when it is a common rule, else generation_masks(), which
+// tests the masks of the current rule
+life_kernel bitwise_kernel(struct rule* r);
+void generation_masks(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                      int last_word, uint64_t last_mask);
+
+// the kernel for radius > 1: the cells are counted with running sums down
+// each column and along each row, so a cell costs the same at any radius
+void generation_ltl(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                    int last_word, uint64_t last_mask);
+
+// advance a whole packed board (rows * words_per_row(columns) words) by
+// generations with HashLife, in place, keeping the node pool and caches
+// within memory bytes; returns -1 if that is too little
+#define HASHLIFE_MEMORY_MB 1024
+int run_hashlife(uint64_t* board, int rows, int columns, long long generations, size_t memory);
+
+// return # neighbors of cell [row][column] of a board with pitch words per
+// row (row 0 is the ghost row above)
+int count_neighbors(uint64_t* board, int r, int c, int pitch);
+
+// given # of neighbors and current value, return next value under the
+// current radius 1 rule
 int next_value(int cur_val, int neighbors);
 
 // helper function to convert 2D to 1D index
 int index1D(int r, int c, int columns) { return r * columns + c; }
 
-void swapBrd(int **new_board, int **old_board);
+// number of packed words needed for a row of columns cells
+int words_per_row(int columns) { return (columns + CELLS_PER_WORD - 1) / CELLS_PER_WORD; }
+
+// value of cell c in a packed row that starts with its left guard word;
+// c may be -1 or the last column + 1 to read the guard words
+int get_cell(uint64_t* row, int c) {
+    return (row[(c + CELLS_PER_WORD) / CELLS_PER_WORD] >> ((c + CELLS_PER_WORD) % CELLS_PER_WORD)) & 1;
+}
+
+// a bijective 64-bit mix (the splitmix64 finaliser)
+uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// split n items into parts pieces, the first n % parts get one extra
+int split_count(int n, int parts, int i) { return n / parts + (i < n % parts); }
+int split_start(int n, int parts, int i) { return i * (n / parts) + (i < n % parts ? i : n % parts); }
+
+// pick the process grid shape for size ranks on a rows x words board
+void choose_grid(int size, int rows, int words, int* dims);
+
+// build the Cartesian grid and work out this rank's block with a halo
+// good for halo_depth generations of a rule of this radius; dims[i] == 0
+// lets choose_grid() pick that dimension
+void setup_domain(struct domain* d, int rows, int columns, int* dims, int halo_depth, int radius);
+void free_domain(struct domain* d);
+
+// time the exchange and the kernel on scratch boards and pick the halo
+// depth that best trades messages for recomputed ghost rows
+int tune_halo_depth(struct domain* d, life_kernel kernel);
+
+// size of a local board and a pointer to its first owned word
+size_t local_board_words(struct domain* d) { return (size_t) (d->local_rows + 2 * d->halo_rows) * d->pitch; }
+
+// allocate a zeroed local board, each thread first touching the rows it
+// will update so they land on its NUMA node
+uint64_t* alloc_local_board(struct domain* d);
+
+// pin thread i to the i-th core of the rank's affinity mask
+void pin_threads(void);
+uint64_t* owned_block(struct domain* d, uint64_t* local_board) {
+    return local_board + d->halo_rows * d->pitch + d->halo_words;
+}
+
+// rank 0 hands out / collects the packed board block by block
+void scatter_board(struct domain* d, uint64_t* board, uint64_t* local_board);
+void gather_board(struct domain* d, uint64_t* board, uint64_t* local_board);
+
+// every rank reads its block of a binary board into local_board
+void read_board_block(struct domain* d, MPI_File file, uint64_t* local_board);
+
+// rank 0 alone reads the whole of a binary board (for HashLife)
+uint64_t* read_board_file(MPI_File file, int rows, int columns);
+
+// set the live cells of pattern p, moved down and right by offset, in the
+// local boards, or all of them in a whole board on rank 0 (for HashLife)
+void place_pattern(struct domain* d, struct pattern* p, int* offset, uint64_t* local_board);
+uint64_t* gather_pattern(MPI_Comm comm, struct pattern* p, int* offset, int rows, int columns);
+
+// Random boards (--random RxC) are made where they are used: each word is
+// a function of the seed and its place on the board alone, so every rank
+// fills its own block and the board is the same for any decomposition.
+// Each cell is alive with --density, rounded to a multiple of 1/256.
+#define RANDOM_DENSITY 0.3
+struct random_board {
+    int rows, columns;                  // 0 when not asked for
+    double density;
+    uint64_t seed;
+};
+void fill_random(struct domain* d, struct random_board* r, uint64_t* local_board);
+// the whole board on rank 0 (for HashLife)
+uint64_t* random_board(struct random_board* r);
+
+// Ensembles (--boards LIST or --seeds A-B): many small independent boards
+// in one job, each run start to finish by one thread with no exchange.
+// LIST names a binary board file per line; a seed range makes a --random
+// board per seed. Ranks take batches of boards from a counter on rank 0
+// with MPI_Fetch_and_op whenever they run out, and their threads share
+// each batch dynamically, so boards of uneven cost still keep every core
+// busy. Rank 0 prints one CSV line per board: its size, first and final
+// population, and the generation from which it repeats with a period of
+// at most --stop-period (ENSEMBLE_PERIOD if not given), or -1.
+#define ENSEMBLE_PERIOD 15
+#define ENSEMBLE_BATCH 4                // boards taken per thread at a time
+#define ENSEMBLE_FIELDS 6               // rows, columns, first and final population, stable, period
+struct ensemble {
+    char** paths;                       // board files, or NULL for seeds
+    long long first, count;             // seeds are first .. first + count - 1
+    struct random_board random;         // size and density of the seeded boards
+};
+
+// fill e->paths from the board list; 0 if it names no boards
+int read_board_list(const char* path, struct ensemble* e);
+// run every board for generations; rank 0 prints the summaries
+void run_ensemble(struct ensemble* e, life_kernel kernel, long long generations, int period, int timing);
+
+// every rank writes its block of local_board straight into a binary board
+// file, without a gather; rank 0 alone can write a whole board instead
+void write_board_block(struct domain* d, MPI_File file, uint64_t* local_board);
+void write_board_file(MPI_File file, uint64_t* board, int rows, int columns);
+
+// print the slowest rank's time for each phase to stderr; phase holds
+// input, generations, output and the part of generations spent in the
+// kernels, the rest being the exchange and waiting for it
+#define PHASES 4
+void report_timing(double* phase);
+
+// Profiling (--profile): the parts of a run are bracketed with
+// profile_begin() and profile_end(), which come down to one predictable
+// branch when profiling is off. Each rank adds up the time, calls and
+// bytes moved per part; at the end these are reduced over the ranks and
+// rank 0 prints the min, mean and max over the ranks that ran each part,
+// the spread being imbalance and waiting. --trace FILE also keeps every interval, up to TRACE_EVENTS per
+// rank, and writes them as a Chrome trace with one track per rank.
+#define TRACE_EVENTS (1 << 20)
+enum profile_part {
+    PROFILE_INPUT, PROFILE_SCATTER, PROFILE_HALO_START, PROFILE_INTERIOR, PROFILE_HALO_WAIT,
+    PROFILE_BOUNDARY, PROFILE_STEPS, PROFILE_HASH, PROFILE_CHECKPOINT, PROFILE_SNAPSHOT, PROFILE_BALANCE,
+    PROFILE_GATHER, PROFILE_OUTPUT, PROFILE_PARTS
+};
+struct trace_event {
+    int part;
+    double begin, end;
+    long long bytes;
+};
+struct profile {
+    int on;
+    double origin;                      // MPI_Wtime() at the start
+    double time[PROFILE_PARTS];
+    long long calls[PROFILE_PARTS], bytes[PROFILE_PARTS];
+    const char* trace_path;             // NULL unless tracing
+    struct trace_event* events;
+    size_t event_count;
+};
+static struct profile profile;
+
+void start_profile(const char* trace_path);
+void profile_record(int part, double begin, long long bytes);
+static inline double profile_begin(void) { return profile.on ? MPI_Wtime() : 0; }
+static inline void profile_end(int part, double begin, long long bytes) {
+    if (profile.on) profile_record(part, begin, bytes);
+}
+// reduce and print the totals, and write the trace if asked for
+void report_profile(void);
+
+// Checkpoints (--checkpoint PREFIX) are binary board files, PREFIX.<gen>.bin,
+// so a restart can use any number of ranks. Each rank copies its block
+// aside and writes it with a non-blocking collective write underneath the
+// next generations. The write is completed at the next checkpoint or at
+// the end of the run, and only then does rank 0 point PREFIX.latest at it,
+// so a crash mid-write leaves the previous checkpoint in charge.
+#define CHECKPOINT_SECONDS 600          // default interval
+#define CHECKPOINT_CALIBRATION 16       // generations timed before the first one
+struct checkpoint {
+    const char* prefix;
+    long long every;                    // generations between checkpoints, or 0
+    double seconds;                     // or seconds between them, or 0
+    long long next;                     // generation of the next one
+    long long last;                     // generation of the last one started
+    double last_time;                   // when it was started
+    long long writing;                  // generation being written, or -1
+    long long complete;                 // generation in PREFIX.latest, or -1
+    MPI_File file;
+    MPI_Request request;
+    uint64_t* snapshot;
+};
+
+// Snapshot streams (--snapshot PATH) keep the board every --snapshot-every
+// generations, and the final one, in one file for visualisation. Each rank copies its block
+// into one of two staging slots and hands it to a background thread, which
+// run-length encodes it; the frame is then appended with a non-blocking
+// collective write while the next one is staged. Compute only waits when
+// the thread or the file is more than a frame behind.
+//
+// The file is a board header (magic LIFESTRM) followed by frames and, at
+// the end, an index of every frame and a trailer pointing at it:
+//   frame:   uint64 generation, chunks; then a chunk per rank
+//   chunk:   uint64 row_start, rows, word_start, words, bytes; then bytes
+//            of runs, each uint32 zero words, uint32 literal words and the
+//            literal words, covering the block row by row
+//   index:   uint64 generation, offset, bytes per frame
+//   trailer: uint64 frames, index offset; magic LIFEINDX
+// life_convert -s N turns frame N back into a text board.
+#define STREAM_MAGIC "LIFESTRM"
+#define STREAM_INDEX_MAGIC "LIFEINDX"
+#define STREAM_ENCODING_RLE64 1
+#define SNAPSHOT_EVERY 100
+#define CHUNK_FIELDS 5
+struct stream_slot {
+    long long generation;
+    uint64_t chunk[CHUNK_FIELDS];       // the chunk header of this rank's block
+    uint64_t* staged;                   // copy of the block
+    size_t staged_capacity;
+    uint8_t* packed;                    // frame header (rank 0), chunk header and runs
+    size_t packed_bytes, packed_capacity;
+    MPI_Request write;
+};
+struct stream {
+    const char* path;
+    long long every;
+    long long next;                     // generation of the next frame
+    int rank, ranks;
+    MPI_File file;
+    MPI_Offset end;                     // where the next frame goes
+    long long frames;                   // frames staged so far
+    uint64_t* index;                    // rank 0: three words per frame
+    struct stream_slot slot[2];         // frame f uses slot f % 2
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int pending;                        // slot the thread is encoding, or -1
+    int quit;
+};
+
+// create the stream file and start the encoding thread; frames are taken
+// at every multiple of s->every from generation start on
+void setup_stream(struct stream* s, struct domain* d, long long start);
+// called between exchange windows: stages a frame when gen == s->next
+void snapshot(struct stream* s, struct domain* d, uint64_t* local_board, long long gen);
+// write out what is left, the index and the trailer
+void finish_stream(struct stream* s);
+
+// --stop-period P ends the run early once the board repeats with a period
+// of at most P. Every generation each rank sums a position-keyed hash over
+// its block, so the total is the same for any decomposition; batches of
+// these partial sums are added up across ranks with MPI_Iallreduce and
+// looked at one batch later, at a generation every rank agrees on.
+#define STOP_BATCH 8                    // generations per reduction
+struct stop {
+    int period;                         // longest period looked for, 0 when off
+    long long start;                    // first generation hashed
+    long long first;                    // generation of pending[0]
+    int pending_count, sent_count;      // sent_count > 0 while a reduction runs
+    long long sent_first;
+    uint64_t pending[STOP_BATCH + MAX_HALO_DEPTH + 1];
+    uint64_t sent[STOP_BATCH + MAX_HALO_DEPTH + 1];
+    uint64_t reduced[STOP_BATCH + MAX_HALO_DEPTH + 1];
+    MPI_Request request;
+    uint64_t* history;                  // global hashes by generation % (period + 1)
+    uint64_t* tile_hash;                // with --active, the share of each tile
+    uint64_t total;                     // and their sum
+    long long stable;                   // first generation of the cycle found
+    int cycle;                          // its period, 0 until one is found
+};
+
+void setup_stop(struct stop* s, int period, long long start);
+// hash the generation just computed
+void hash_generation(struct stop* s, struct domain* d, uint64_t* local_board);
+// called between exchange windows: 1 once a cycle has been found
+int check_stop(struct stop* s);
+// start the per-tile hashes over after the tile grid changed
+void retile_stop(struct stop* s);
+// look at whatever is still outstanding at the end of the run
+void finish_stop(struct stop* s);
+
+// Load balancing (--balance N): every N generations the time each process
+// row spent in the kernels is compared, and when the slowest is more than
+// the threshold above the average the row boundaries move so that every
+// process row gets an equal share of the measured cost. The rows that
+// change hands go point-to-point along each process column.
+#define BALANCE_THRESHOLD 0.1
+struct balance {
+    long long every;                    // generations between checks, 0 when off
+    double threshold;                   // tolerated imbalance
+    long long next;                     // generation of the next check
+    double busy;                        // kernel time since the last check
+};
+
+// called between exchange windows: 1 if the row boundaries moved, in which
+// case both boards have been replaced and the ghost zones are empty
+int rebalance(struct balance* b, struct domain* d, uint64_t** local_board, uint64_t** local_swap_board, long long gen);
+
+// schedule checkpoints from generation start on
+void setup_checkpoint(struct checkpoint* c, long long start);
+// called between generations: starts a checkpoint when one is due
+void checkpoint(struct checkpoint* c, struct domain* d, uint64_t* local_board, long long gen);
+// complete the write in flight, if any, and make it the latest
+void finish_checkpoint(struct checkpoint* c);
+// the board file and generation PREFIX.latest points at; NULL if none
+char* latest_checkpoint(MPI_Comm comm, const char* prefix, long long* gen);
+
+// Shared-memory halos (--shared): the ranks on a node keep both of their
+// local boards in one MPI_Win_allocate_shared window, so the ghost zone
+// from a neighbour on the same node is copied straight out of its board
+// rather than sent. Each rank raises one counter once its board holds the
+// generation an exchange is for and another once it has copied from its
+// neighbours, and waits for the second on theirs before it overwrites that
+// board. Neighbours on other nodes still get messages.
+#define SHARED_FLAG_WORDS 8             // ready and copied, padded to a cache line
+struct shared {
+    MPI_Comm node;
+    MPI_Win window;
+    uint64_t* base;                     // my flags, then my two boards
+    uint64_t exchange;                  // exchanges started
+    int on_node[3][3];                  // by neighbour, as domain.nbr
+    uint64_t* peer[3][3];               // its flags and boards
+    size_t peer_board_words[3][3];
+    int peer_pitch[3][3];
+    struct region source[3][3];         // its edge that lands in my ghost zone
+};
+
+// allocate both local boards in the node's shared window
+void setup_shared(struct domain* d, uint64_t** local_board, uint64_t** local_swap_board);
+void free_shared(struct domain* d);
+
+// post the non-blocking exchange that fills the ghost rows and guard words
+// of local_board from the 8 neighbours; complete it with finish_halo(),
+// which with active tiles also copies fresh ghost data into other_board
+#define HALO_REQUESTS 16
+void start_halo(struct domain* d, uint64_t* local_board, MPI_Request* requests);
+void finish_halo(struct domain* d, uint64_t* local_board, uint64_t* other_board, MPI_Request* requests);
+
+// the ghost zone received from (send == 0) or edge sent to (send == 1)
+// the neighbour at offset [dr][dc]
+struct region halo_zone(struct domain* d, int dr, int dc, int send);
+
+// start tracking active tiles, every tile counting as changed; call
+// end_generation() after each generation to roll the flags over
+void setup_tiles(struct domain* d);
+void free_tiles(struct domain* d);
+void end_generation(struct domain* d);
+
+// the cells to compute in step 1..halo_rows after an exchange: the owned
+// block plus the part of the ghost zone that is still exact, which shrinks
+// by a row every step
+struct region step_region(struct domain* d, int step);
+
+// run the kernel over region r, its rows (or active tiles) split evenly
+// over the threads; call it outside any parallel region, MPI stays on the
+// master thread
+void update_region(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board, struct region r);
+
+// the first step after an exchange is split so the exchange can run
+// underneath the interior: update_interior() touches no ghost data,
+// update_boundary() does the rest of step_region(d, 1) once it is done
+void update_interior(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board);
+void update_boundary(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board);
+
+void swapBrd(uint64_t **new_board, uint64_t **old_board);
+
+void usage() {
+    printf("Usage: ./life.x [-k bitwise|stencil|hashlife] [-m MB] [-g PxQ] [-d depth|auto] [-t threads] [-a]\n"
+           "                [-i board.bin | -p pattern.rle [-s RxC] | -r RxC [--density F] [--seed N]]\n"
+           "                [-o board.bin] [--timing] [--profile] [--trace trace.json]\n"
+           "                [-c prefix [--checkpoint-every N] [--checkpoint-seconds T] [--restart]]\n"
+           "                [-e period] [-b N [--balance-threshold F]] [--rule B3/S23] [--radius R]\n"
+           "                [--snapshot run.stream [--snapshot-every N]] [--shared] [generations]\n"
+           "       ./life.x --boards list.txt | -r RxC [--density F] --seeds A-B\n"
+           "                [-k bitwise|stencil] [-t threads] [-e period] [--rule B3/S23] [--radius R]\n"
+           "                [--timing] generations\n");
+}
 
 int main(int argc, char** argv) {
-    int rows, columns, rank, size, up_nbr, down_nbr;
-    int *board, *local_swap_board, *sendcounts, *offsets, *tmp_swap, *rows_columns;
-    int generations;
-    int *local_board;
-    if (argc != 2) {
-        printf("Usage: ./life.x [generations]\n");
-        exit(1);
-    }
+    int rows, columns, rank, size, opt;
+    int *rows_columns;
+    int dims[2] = {0, 0};
+    int halo_depth = 1;
+    int threads = 0, provided;
+    int active = 0;
+    int hashlife = 0, failed = 0;
+    size_t memory_mb = HASHLIFE_MEMORY_MB;
+    char *input = NULL, *output = NULL, *pattern_path = NULL;
+    struct pattern pattern;
+    int size_override[2] = {0, 0}, offset[2] = {0, 0};
+    struct checkpoint ckpt = {NULL, 0, 0, 0, 0, 0, -1, -1, MPI_FILE_NULL, MPI_REQUEST_NULL, NULL};
+    int restart = 0;
+    struct stop stop;
+    int stop_period = 0;
+    struct balance balance = {0, BALANCE_THRESHOLD, 0, 0};
+    struct random_board random = {0, 0, RANDOM_DENSITY, 1};
+    long long start = 0;
+    char* restart_path = NULL;
+    MPI_File input_file = MPI_FILE_NULL, output_file;
+    int timing = 0, profiling = 0;
+    const char* trace_path = NULL;
+    double phase[PHASES] = {0}, phase_start;
+    uint64_t *board, *local_swap_board;
+    long long generations;
+    uint64_t *local_board;
+    struct domain d;
+    MPI_Request halo[HALO_REQUESTS];
+    life_kernel kernel = generation;
+    const char* rule_text = LIFE_RULE;
+    int radius = 1;
+    const char* boards_path = NULL;
+    struct ensemble ensemble = {NULL, 0, 0, {0, 0, 0, 0}};
+    long long last_seed;
+    struct stream stream = {.path = NULL, .every = SNAPSHOT_EVERY};
+    int shared = 0;
 
-    MPI_Init(&argc, &argv);
+    // only the master thread ever calls MPI
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    MPI_Status status;
+
+    static struct option long_options[] = {
+        {"kernel", required_argument, 0, 'k'},
+        {"grid", required_argument, 0, 'g'},
+        {"halo-depth", required_argument, 0, 'd'},
+        {"threads", required_argument, 0, 't'},
+        {"active", no_argument, 0, 'a'},
+        {"memory", required_argument, 0, 'm'},
+        {"input", required_argument, 0, 'i'},
+        {"output", required_argument, 0, 'o'},
+        {"timing", no_argument, 0, 'T'},
+        {"pattern", required_argument, 0, 'p'},
+        {"size", required_argument, 0, 's'},
+        {"checkpoint", required_argument, 0, 'c'},
+        {"checkpoint-every", required_argument, 0, 'N'},
+        {"checkpoint-seconds", required_argument, 0, 'S'},
+        {"restart", no_argument, 0, 'R'},
+        {"stop-period", required_argument, 0, 'e'},
+        {"balance", required_argument, 0, 'b'},
+        {"balance-threshold", required_argument, 0, 'H'},
+        {"random", required_argument, 0, 'r'},
+        {"density", required_argument, 0, 'D'},
+        {"seed", required_argument, 0, 'X'},
+        {"profile", no_argument, 0, 'P'},
+        {"trace", required_argument, 0, 'Z'},
+        {"rule", required_argument, 0, 'L'},
+        {"radius", required_argument, 0, 'Q'},
+        {"boards", required_argument, 0, 'B'},
+        {"seeds", required_argument, 0, 'E'},
+        {"snapshot", required_argument, 0, 'W'},
+        {"snapshot-every", required_argument, 0, 'V'},
+        {"shared", no_argument, 0, 'Y'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "k:g:d:t:am:i:o:Tp:s:c:e:b:r:", long_options, NULL)) != -1) {
+        if (opt == 'k' && strcmp(optarg, "bitwise") == 0) kernel = generation;
+        else if (opt == 'k' && strcmp(optarg, "stencil") == 0) kernel = generation_stencil;
+        else if (opt == 'k' && strcmp(optarg, "hashlife") == 0) hashlife = 1;
+        else if (opt == 'm' && (memory_mb = strtoul(optarg, NULL, 10)) > 0);
+        else if (opt == 'g' && sscanf(optarg, "%dx%d", &dims[0], &dims[1]) == 2
+                 && dims[0] > 0 && dims[1] > 0 && dims[0] * dims[1] == size);
+        else if (opt == 'd' && strcmp(optarg, "auto") == 0) halo_depth = 0;
+        else if (opt == 'd' && (halo_depth = atoi(optarg)) >= 1 && halo_depth <= MAX_HALO_DEPTH);
+        else if (opt == 't' && (threads = atoi(optarg)) >= 1);
+        else if (opt == 'a') active = 1;
+        else if (opt == 'i') input = optarg;
+        else if (opt == 'o') output = optarg;
+        else if (opt == 'T') timing = 1;
+        else if (opt == 'p') pattern_path = optarg;
+        else if (opt == 's' && sscanf(optarg, "%dx%d", &size_override[0], &size_override[1]) == 2
+                 && size_override[0] > 0 && size_override[1] > 0);
+        else if (opt == 'c') ckpt.prefix = optarg;
+        else if (opt == 'N' && (ckpt.every = atoll(optarg)) > 0);
+        else if (opt == 'S' && (ckpt.seconds = atof(optarg)) > 0);
+        else if (opt == 'R') restart = 1;
+        else if (opt == 'e' && (stop_period = atoi(optarg)) > 0);
+        else if (opt == 'b' && (balance.every = atoll(optarg)) > 0);
+        else if (opt == 'H' && (balance.threshold = atof(optarg)) >= 0);
+        else if (opt == 'r' && sscanf(optarg, "%dx%d", &random.rows, &random.columns) == 2
+                 && random.rows > 0 && random.columns > 0);
+        else if (opt == 'D' && (random.density = atof(optarg)) >= 0 && random.density <= 1);
+        else if (opt == 'X') random.seed = strtoull(optarg, NULL, 10);
+        else if (opt == 'P') profiling = 1;
+        else if (opt == 'Z') trace_path = optarg;
+        else if (opt == 'L') rule_text = optarg;
+        else if (opt == 'Q' && (radius = atoi(optarg)) >= 1 && radius <= MAX_RADIUS);
+        else if (opt == 'B') boards_path = optarg;
+        else if (opt == 'E' && sscanf(optarg, "%lld-%lld", &ensemble.first, &last_seed) == 2
+                 && ensemble.first >= 0 && last_seed >= ensemble.first)
+            ensemble.count = last_seed - ensemble.first + 1;
+        else if (opt == 'W') stream.path = optarg;
+        else if (opt == 'V' && (stream.every = atoll(optarg)) > 0);
+        else if (opt == 'Y') shared = 1;
+        else {
+            if (rank == 0) usage();
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || (restart && !ckpt.prefix) || !parse_rule(rule_text, radius, &rule)
+        || (ensemble.count && (!random.rows || boards_path)) || ((ensemble.count || boards_path) && hashlife)
+        || (stream.path && hashlife) || (shared && balance.every)) {
+        if (rank == 0) usage();
+        MPI_Finalize();
+        exit(1);
+    }
+    if (radius > 1 && kernel == generation_stencil) {
+        if (rank == 0) fprintf(stderr, "The stencil kernel only supports radius 1\n");
+        MPI_Finalize();
+        exit(1);
+    }
+    if (radius > 1) kernel = generation_ltl;
+    else if (kernel == generation) kernel = bitwise_kernel(&rule);
+    if (hashlife && (radius > 1 || rule.next[0][0])) {
+        // births in empty space would break HashLife's dead surroundings
+        if (rank == 0) fprintf(stderr, "HashLife needs a radius 1 rule without B0\n");
+        MPI_Finalize();
+        exit(1);
+    }
+    if (ckpt.prefix && !ckpt.every && !ckpt.seconds) ckpt.seconds = CHECKPOINT_SECONDS;
+    if (threads) omp_set_num_threads(threads);
+    if (omp_get_max_threads() > 1 && provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) fprintf(stderr, "MPI library does not support MPI_THREAD_FUNNELED\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    pin_threads();
+    if (rank == 0) setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+    if (boards_path || ensemble.count) {
+        if (boards_path && !read_board_list(boards_path, &ensemble)) {
+            if (rank == 0) fprintf(stderr, "No boards listed in %s\n", boards_path);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        ensemble.random = random;
+        run_ensemble(&ensemble, kernel, atoll(argv[optind]), stop_period ? stop_period : ENSEMBLE_PERIOD, timing);
+        if (ensemble.paths) {
+            for (long long i = 0; i < ensemble.count; i++) free(ensemble.paths[i]);
+            free(ensemble.paths);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    if (profiling || trace_path) start_profile(trace_path);
+
+    phase_start = MPI_Wtime();
     board = NULL;
     rows_columns = malloc(sizeof(int) * 2);
-    if (rank == 0) {
+    if (restart) {
+        // the latest checkpoint replaces whatever the input would have been
+        restart_path = latest_checkpoint(MPI_COMM_WORLD, ckpt.prefix, &start);
+        if (!restart_path) {
+            if (rank == 0) fprintf(stderr, "No complete checkpoint under %s\n", ckpt.prefix);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        input = restart_path;
+        pattern_path = NULL;
+        random.rows = 0;
+    }
+    if (input) {
+        input_file = open_board_file(MPI_COMM_WORLD, input, &rows, &columns);
+        if (hashlife && rank == 0) board = read_board_file(input_file, rows, columns);
+    }
+    else if (random.rows) {
+        rows = random.rows;
+        columns = random.columns;
+        if (hashlife && rank == 0) board = random_board(&random);
+    }
+    else if (pattern_path) {
+        // the pattern sits in the middle of a board of --size, if given
+        read_pattern(MPI_COMM_WORLD, pattern_path, &pattern);
+        rows = size_override[0] ? size_override[0] : pattern.rows;
+        columns = size_override[1] ? size_override[1] : pattern.columns;
+        if (rows < pattern.rows || columns < pattern.columns) {
+            if (rank == 0) fprintf(stderr, "Pattern is %dx%d, larger than the board\n", pattern.rows, pattern.columns);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        offset[0] = (rows - pattern.rows) / 2;
+        offset[1] = (columns - pattern.columns) / 2;
+        if (hashlife) board = gather_pattern(MPI_COMM_WORLD, &pattern, offset, rows, columns);
+    }
+    else if (rank == 0) {
+        double t = profile_begin();
         board = get_initial_board(&rows, &columns);
+        profile_end(PROFILE_INPUT, t, (long long) rows * words_per_row(columns) * sizeof(uint64_t));
         rows_columns[0] = rows;
         rows_columns[1] = columns;
         MPI_Bcast(rows_columns, 2, MPI_INT, 0, MPI_COMM_WORLD);// broadcast size of full board
@@ -54,174 +780,2796 @@ int main(int argc, char** argv) {
         rows = rows_columns[0];
         columns = rows_columns[1];
     }
-    generations = atoi(argv[1]);
+    generations = atoll(argv[optind]);
+    if (restart && generations < start) {
+        if (rank == 0)
+            fprintf(stderr, "Checkpoint %s is at generation %lld, past the %lld asked for\n", restart_path, start,
+                    generations);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
     //printf("Rows: %d; Columns: %d\n", rows, columns); // debug
 
-    sendcounts = malloc(sizeof(int) * size); //array inexed by rank with num elements sent to each process
+    if (hashlife) {
+        // HashLife is serial and runs on rank 0 alone
+        if (input) MPI_File_close(&input_file);
+        if (pattern_path) free_pattern(&pattern);
+        phase[0] = MPI_Wtime() - phase_start;
+        phase_start = MPI_Wtime();
+        if (rank == 0 && generations > start)
+            failed = run_hashlife(board, rows, columns, generations - start, memory_mb << 20) != 0;
+        MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        phase[1] = MPI_Wtime() - phase_start;
+        phase[3] = phase[1];            // there is no exchange, it is all compute
+        phase_start = MPI_Wtime();
+        if (!failed && output) {
+            output_file = create_board_file(MPI_COMM_WORLD, output, rows, columns);
+            if (rank == 0) write_board_file(output_file, board, rows, columns);
+            MPI_File_close(&output_file);
+        }
+        else if (!failed && rank == 0) {
+            printf("Final board:\n");
+            write_board(board, rows, columns);
+            fflush(stdout);
+        }
+        phase[2] = MPI_Wtime() - phase_start;
+        if (timing && !failed) report_timing(phase);
+        free(board);
+        free(rows_columns);
+        free(restart_path);
+        MPI_Finalize();
+        return failed;
+    }
+
+    if (halo_depth == 0) {
+        // the scratch exchanges are no part of the run
+        int on = profile.on;
+        setup_domain(&d, rows, columns, dims, 1, radius);
+        profile.on = 0;
+        halo_depth = tune_halo_depth(&d, kernel);
+        profile.on = on;
+        free_domain(&d);
+    }
+    setup_domain(&d, rows, columns, dims, halo_depth, radius);
+
+    // zeroing leaves the ghost rows and guard words at the board edges dead
+    if (shared) {
+        setup_shared(&d, &local_board, &local_swap_board);
+    }
+    else {
+        local_board = alloc_local_board(&d);
+        local_swap_board = alloc_local_board(&d);
+    }
 
-    for (int i = 0; i < size; i++) {
-        sendcounts[i] = columns * ((rows / size) + 1);
+    long long block_bytes = (long long) d.local_rows * d.local_words * sizeof(uint64_t);
+    double t = profile_begin();
+    if (input) {
+        read_board_block(&d, input_file, local_board);
+        MPI_File_close(&input_file);
+        profile_end(PROFILE_INPUT, t, block_bytes);
+    }
+    else if (random.rows) {
+        fill_random(&d, &random, local_board);
+        profile_end(PROFILE_INPUT, t, 0);
+    }
+    else if (pattern_path) {
+        place_pattern(&d, &pattern, offset, local_board);
+        profile_end(PROFILE_INPUT, t, 0);
+    }
+    else {
+        scatter_board(&d, board, local_board);
+        profile_end(PROFILE_SCATTER, t, block_bytes);
     }
-    int too_big = (size * ((rows / size) + 1)) - (size * (rows / size) + rows % size);
-    //too_big is the number of extra rows I allocated to processes max of 1 extra per process
+    if (active) setup_tiles(&d);
+    if (ckpt.prefix) setup_checkpoint(&ckpt, start);
+    if (stream.path) setup_stream(&stream, &d, start);
+    setup_stop(&stop, stop_period, start);
+    if (stop.period) hash_generation(&stop, &d, local_board);
+    phase[0] = MPI_Wtime() - phase_start;
+    phase_start = MPI_Wtime();
+    long long requested = generations;
+    balance.next = start + balance.every;
+    for (long long gen = start; gen < generations; ) {
+        if (ckpt.prefix) checkpoint(&ckpt, &d, local_board, gen);
+        if (stream.path) snapshot(&stream, &d, local_board, gen);
+        if (balance.every && gen >= balance.next
+            && rebalance(&balance, &d, &local_board, &local_swap_board, gen)) {
+            // the tile grid follows the block; everything counts as changed
+            if (active) {
+                free_tiles(&d);
+                setup_tiles(&d);
+            }
+            retile_stop(&stop);
+        }
+
+        // one exchange carries the ghost zone for up to halo_rows generations
+        double busy_start = MPI_Wtime();
+        start_halo(&d, local_board, halo);
+        t = profile_begin();
+        update_interior(&d, kernel, local_swap_board, local_board);
+        profile_end(PROFILE_INTERIOR, t, 0);
+        double busy = MPI_Wtime() - busy_start;
+        t = profile_begin();
+        finish_halo(&d, local_board, local_swap_board, halo);
+        profile_end(PROFILE_HALO_WAIT, t, 0);
+        busy_start = MPI_Wtime();
+        t = profile_begin();
+        update_boundary(&d, kernel, local_swap_board, local_board);
+        swapBrd(&local_board, &local_swap_board);
+        end_generation(&d);
+        profile_end(PROFILE_BOUNDARY, t, 0);
+        if (stop.period) hash_generation(&stop, &d, local_board);
+        gen++;
 
+        // a window ends early at a snapshot, which needs the owned block
+        for (int step = 2; step <= d.depth && gen < generations && !(stream.path && gen == stream.next);
+             step++, gen++) {
+            t = profile_begin();
+            update_region(&d, kernel, local_swap_board, local_board, step_region(&d, step));
+            swapBrd(&local_board, &local_swap_board);
+            end_generation(&d);
+            profile_end(PROFILE_STEPS, t, 0);
+            if (stop.period) hash_generation(&stop, &d, local_board);
+        }
+        busy += MPI_Wtime() - busy_start;
+        balance.busy += busy;
+        phase[3] += busy;
 
-    int decrementer = 1; // used to count backwards in send counts and remove extra rows
-    while (too_big > 0) {
-        sendcounts[size - decrementer] -= columns; // remove a row by removing columns number of integers
-        too_big--;
-        decrementer++;
+        // from here on the board only goes round the cycle, so it is enough
+        // to go on to the generation the requested one is equivalent to
+        if (stop.period && check_stop(&stop)) generations = gen + (generations - gen) % stop.cycle;
+    }
+    if (ckpt.prefix) finish_checkpoint(&ckpt);
+    if (stream.path) {
+        // the last board is always a frame, whatever the interval
+        stream.next = generations;
+        snapshot(&stream, &d, local_board, generations);
+        finish_stream(&stream);
     }
+    finish_stop(&stop);
+    if (rank == 0 && stop.cycle)
+        fprintf(stderr, "Stable from generation %lld with period %d, ran %lld of %lld generations\n",
+                stop.stable, stop.cycle, generations, requested);
+    phase[1] = MPI_Wtime() - phase_start;
 
-    offsets = malloc(sizeof(int) * size);// array to inform rank 0 where to break up input array
-    offsets[0] = 0;
-    for (int i = 1; i < size; i++) {
-        offsets[i] = offsets[i - 1] + sendcounts[i - 1];
+    phase_start = MPI_Wtime();
+    block_bytes = (long long) d.local_rows * d.local_words * sizeof(uint64_t);
+    t = profile_begin();
+    if (output) {
+        output_file = create_board_file(MPI_COMM_WORLD, output, rows, columns);
+        write_board_block(&d, output_file, local_board);
+        MPI_File_close(&output_file);
+        profile_end(PROFILE_OUTPUT, t, block_bytes);
     }
+    else {
+        if (rank == 0 && !board) board = malloc((size_t) rows * d.words * sizeof(uint64_t));
+        gather_board(&d, board, local_board);
+        profile_end(PROFILE_GATHER, t, block_bytes);
 
-    local_board = malloc(sizeof(int) * ( 3 * ((rows / size) * columns) + columns));
-    local_swap_board = malloc(sizeof(int) * ( 3 * ((rows / size) * columns) + columns));
-    MPI_Scatterv(board, sendcounts, offsets, MPI_INT, local_board + columns, sendcounts[rank], MPI_INT, 0, MPI_COMM_WORLD);
-    for (int gen = 0; gen < generations; gen++) {
-        if (rank == 0){
-            for (int i = 0; i < columns; i++) local_board[i] = 0;
-            //set top ghost row of data to all zeros so as not to influence neighbor count
+        if (rank == 0) {
+        t = profile_begin();
+        printf("Final board:\n");
+        write_board(board, rows, columns);
+        fflush(stdout);
+        profile_end(PROFILE_OUTPUT, t, (long long) rows * d.words * sizeof(uint64_t));
         }
-        if (rank == size - 1){
-            int start = sendcounts[rank] + columns;
-            for (int i = start; i < start + columns; i++) local_board[i] = 0;
-            //set bottom ghost row of data to all zeros so as not to influence neighbor count
+    }
+    phase[2] = MPI_Wtime() - phase_start;
+    if (timing) report_timing(phase);
+    if (profile.on) report_profile();
+
+    if (pattern_path) free_pattern(&pattern);
+    free_tiles(&d);
+    if (d.shared) {
+        free_shared(&d);
+    }
+    else {
+        free(local_board);
+        free(local_swap_board);
+    }
+    free_domain(&d);
+    free(board);
+    free(rows_columns);
+    free(restart_path);
+    MPI_Finalize();
+    return 0;
+}
+
+void choose_grid(int size, int rows, int words, int* dims) {
+    // Each generation a rank sends two rows of its words and two columns of
+    // its rows; pick the factorisation of size that minimises that, without
+    // giving any rank an empty block. Ties go to more process rows, whose
+    // halo rows are contiguous messages.
+    long best = -1;
+    for (int p = size; p >= 1; p--) {
+        int q = size / p;
+        if (size % p != 0 || q > words || p > rows) continue;
+        long cost = 2L * ((words + q - 1) / q) + (q > 1 ? 2L * ((rows + p - 1) / p) : 0);
+        if (best < 0 || cost < best) {
+            best = cost;
+            dims[0] = p;
+            dims[1] = q;
         }
+    }
+    if (best < 0) {
+        // more ranks than the board can be cut into: strips, some of them empty
+        dims[0] = size;
+        dims[1] = 1;
+    }
+}
+
+static void setup_types(struct domain* d);
 
-        up_nbr = rank + 1;
-        if (up_nbr >= size) up_nbr = MPI_PROC_NULL;
-        down_nbr = rank - 1;
-        if (down_nbr < 0) down_nbr = MPI_PROC_NULL;
+void setup_domain(struct domain* d, int rows, int columns, int* dims, int halo_depth, int radius) {
+    int rank, size, periods[2] = {0, 0};
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    d->rows = rows;
+    d->columns = columns;
+    d->words = words_per_row(columns);
+    d->dims[0] = dims[0];
+    d->dims[1] = dims[1];
+    if (d->dims[0] == 0 || d->dims[1] == 0) choose_grid(size, rows, d->words, d->dims);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (d->dims[1] > d->words) {
+        if (rank == 0) fprintf(stderr, "Grid %dx%d does not fit a board %d words wide\n", d->dims[0], d->dims[1], d->words);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // no reordering: world rank 0 read the board and must stay at (0, 0)
+    MPI_Cart_create(MPI_COMM_WORLD, 2, d->dims, periods, 0, &d->cart);
+    MPI_Comm_rank(d->cart, &rank);
+    MPI_Cart_coords(d->cart, rank, 2, d->coords);
+    int keep_columns[2] = {0, 1}, keep_rows[2] = {1, 0};
+    MPI_Cart_sub(d->cart, keep_columns, &d->row_comm);
+    MPI_Cart_sub(d->cart, keep_rows, &d->col_comm);
 
-        if ((rank % 2) == 0) {
-            /* exchange up */
-            MPI_Sendrecv( local_board + sendcounts[rank], columns, MPI_INT, up_nbr, 0,
-                          local_board + sendcounts[rank] + columns, columns, MPI_INT, up_nbr, 0,
-                          MPI_COMM_WORLD, &status );
+    d->local_rows = split_count(rows, d->dims[0], d->coords[0]);
+    d->row_start = split_start(rows, d->dims[0], d->coords[0]);
+    d->local_words = split_count(d->words, d->dims[1], d->coords[1]);
+    d->word_start = split_start(d->words, d->dims[1], d->coords[1]);
+    // recomputing the ghost word needs a spare guard word outside it;
+    // without left and right neighbours the single guard words stay zero
+    d->depth = halo_depth;
+    d->radius = radius;
+    d->halo_rows = halo_depth * radius;
+    d->halo_words = d->dims[1] > 1 && halo_depth > 1 ? 2 : 1;
+    if (d->halo_rows > CELLS_PER_WORD) {
+        if (rank == 0) fprintf(stderr, "Halo depth %d at radius %d reaches past a ghost word\n", halo_depth, radius);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    d->pitch = d->local_words + 2 * d->halo_words;
+
+    // every ghost row has to come from the adjacent block alone
+    int min_rows = d->local_rows ? d->local_rows : INT_MAX;
+    MPI_Allreduce(MPI_IN_PLACE, &min_rows, 1, MPI_INT, MPI_MIN, d->cart);
+    if (d->dims[0] > 1 && min_rows < d->halo_rows) {
+        if (rank == 0) fprintf(stderr, "Halo of %d rows is deeper than the smallest block (%d rows)\n",
+                               d->halo_rows, min_rows);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
+    // with more process rows than board rows the trailing ones are empty;
+    // keep them out of the halo exchange
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            int nbr_coords[2] = {d->coords[0] + dr, d->coords[1] + dc};
+            d->nbr[dr + 1][dc + 1] = MPI_PROC_NULL;
+            if (nbr_coords[0] < 0 || nbr_coords[0] >= d->dims[0] || nbr_coords[0] >= rows
+                || nbr_coords[1] < 0 || nbr_coords[1] >= d->dims[1] || d->local_rows == 0)
+                continue;
+            MPI_Cart_rank(d->cart, nbr_coords, &d->nbr[dr + 1][dc + 1]);
         }
-        else {
-            /* exchange down */
-            MPI_Sendrecv( local_board + columns, columns, MPI_INT, down_nbr, 0,
-                          local_board, columns, MPI_INT, down_nbr, 0,
-                          MPI_COMM_WORLD, &status );
+    }
+    // the board's last word may also be a ghost word that gets recomputed
+    // here, in which case its padding bits have to stay dead as well
+    int last_word = d->words - 1 - d->word_start + d->halo_words;
+    d->tiles = NULL;
+    d->shared = NULL;
+    d->last_word = -1;
+    d->last_mask = ~(uint64_t) 0;
+    if (columns % CELLS_PER_WORD && last_word < d->pitch) {
+        d->last_word = last_word;
+        d->last_mask = ((uint64_t) 1 << (columns % CELLS_PER_WORD)) - 1;
+    }
+
+    setup_types(d);
+}
+
+// the datatypes that depend on the block's rows
+static void setup_types(struct domain* d) {
+    // one word from each owned row; the extent is a single word so that
+    // consecutive columns of a block can be sent with a count
+    MPI_Datatype column;
+    MPI_Type_vector(d->local_rows, 1, d->pitch, MPI_UINT64_T, &column);
+    MPI_Type_create_resized(column, 0, sizeof(uint64_t), &d->column);
+    MPI_Type_commit(&d->column);
+    MPI_Type_free(&column);
+
+    // side neighbours share halo_rows rows or one word of the whole block
+    // edge, diagonal neighbours a halo_rows x 1 corner
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            int height = dr ? d->halo_rows : d->local_rows;
+            int width = dc ? 1 : d->local_words;
+            d->halo_type[dr + 1][dc + 1] = MPI_DATATYPE_NULL;
+            if (dr == 0 && dc == 0) continue;
+            MPI_Type_vector(height, width, d->pitch, MPI_UINT64_T, &d->halo_type[dr + 1][dc + 1]);
+            MPI_Type_commit(&d->halo_type[dr + 1][dc + 1]);
         }
+    }
+}
+
+static void free_types(struct domain* d) {
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            if (d->halo_type[i][j] != MPI_DATATYPE_NULL) MPI_Type_free(&d->halo_type[i][j]);
+    MPI_Type_free(&d->column);
+}
+
+void free_domain(struct domain* d) {
+    free_types(d);
+    MPI_Comm_free(&d->row_comm);
+    MPI_Comm_free(&d->col_comm);
+    MPI_Comm_free(&d->cart);
+}
+
+int rebalance(struct balance* b, struct domain* d, uint64_t** local_board, uint64_t** local_swap_board, long long gen) {
+    int parts = d->dims[0], me = d->coords[0];
+    int min_rows = d->halo_rows > 1 ? d->halo_rows : 1;
+    double cost = b->busy, costs[parts], total = 0, slowest = 0;
+    int counts[parts], starts[parts + 1], bounds[parts + 1];
+    b->next = gen + b->every;
+    b->busy = 0;
+    if (parts == 1 || d->rows < parts * min_rows) return 0;
+
+    double t = profile_begin();
+    long long bytes = 0;
+    // a process row is as slow as its slowest rank
+    MPI_Allreduce(MPI_IN_PLACE, &cost, 1, MPI_DOUBLE, MPI_MAX, d->row_comm);
+    MPI_Allgather(&cost, 1, MPI_DOUBLE, costs, 1, MPI_DOUBLE, d->col_comm);
+    MPI_Allgather(&d->local_rows, 1, MPI_INT, counts, 1, MPI_INT, d->col_comm);
+    starts[0] = 0;
+    for (int p = 0; p < parts; p++) {
+        starts[p + 1] = starts[p] + counts[p];
+        total += costs[p];
+        if (costs[p] > slowest) slowest = costs[p];
+    }
+    if (total <= 0 || slowest <= (1 + b->threshold) * total / parts) {
+        profile_end(PROFILE_BALANCE, t, 0);
+        return 0;
+    }
 
-        /* Do the second set of exchanges */
-        if ((rank % 2) == 1) {
-            /* exchange up */
-            MPI_Sendrecv( local_board + sendcounts[rank], columns, MPI_INT, up_nbr, 1,
-                          local_board + sendcounts[rank] + columns, columns, MPI_INT, up_nbr, 1,
-                          MPI_COMM_WORLD, &status );
+    // cut where the measured cost, spread evenly over the rows of each
+    // block, adds up to equal shares; every block keeps min_rows rows
+    bounds[0] = 0;
+    bounds[parts] = d->rows;
+    double before = 0;
+    for (int q = 1, p = 0; q < parts; q++) {
+        double target = total * q / parts;
+        while (p < parts - 1 && before + costs[p] < target) before += costs[p++];
+        double cut = starts[p] + (costs[p] > 0 ? (target - before) / costs[p] * counts[p] : 0);
+        bounds[q] = (int) (cut + 0.5);
+    }
+    for (int q = 1; q < parts; q++)
+        if (bounds[q] < bounds[q - 1] + min_rows) bounds[q] = bounds[q - 1] + min_rows;
+    for (int q = parts - 1; q > 0; q--)
+        if (bounds[q] > bounds[q + 1] - min_rows) bounds[q] = bounds[q + 1] - min_rows;
+    if (memcmp(bounds, starts, sizeof(bounds)) == 0) {
+        profile_end(PROFILE_BALANCE, t, 0);
+        return 0;
+    }
+
+    // move to the new block, then fetch the rows it has from each old one
+    uint64_t* old_board = *local_board;
+    uint64_t* old_block = owned_block(d, old_board);
+    free_types(d);
+    d->row_start = bounds[me];
+    d->local_rows = bounds[me + 1] - bounds[me];
+    setup_types(d);
+    free(*local_swap_board);
+    *local_board = alloc_local_board(d);
+    *local_swap_board = alloc_local_board(d);
+    uint64_t* new_block = owned_block(d, *local_board);
+
+    // owned words of consecutive stored rows
+    MPI_Datatype row, strided_row;
+    MPI_Type_contiguous(d->local_words, MPI_UINT64_T, &row);
+    MPI_Type_create_resized(row, 0, (MPI_Aint) d->pitch * sizeof(uint64_t), &strided_row);
+    MPI_Type_commit(&strided_row);
+    MPI_Type_free(&row);
+
+    MPI_Request requests[2 * parts];
+    int n = 0;
+    for (int p = 0; p < parts; p++) {
+        // rows of p's new block I held, and rows of mine p held
+        int send_begin = starts[me] > bounds[p] ? starts[me] : bounds[p];
+        int send_end = starts[me + 1] < bounds[p + 1] ? starts[me + 1] : bounds[p + 1];
+        int recv_begin = starts[p] > bounds[me] ? starts[p] : bounds[me];
+        int recv_end = starts[p + 1] < bounds[me + 1] ? starts[p + 1] : bounds[me + 1];
+        if (p == me) {
+            for (int i = recv_begin; i < recv_end; i++)
+                memcpy(new_block + (size_t) (i - bounds[me]) * d->pitch, old_block + (size_t) (i - starts[me]) * d->pitch,
+                       d->local_words * sizeof(uint64_t));
+            continue;
         }
-        else {
-            /* exchange down */
-            MPI_Sendrecv( local_board + columns, columns, MPI_INT, down_nbr, 1,
-                          local_board, columns, MPI_INT, down_nbr, 1,
-                          MPI_COMM_WORLD, &status );
+        if (send_begin < send_end) {
+            MPI_Isend(old_block + (size_t) (send_begin - starts[me]) * d->pitch, send_end - send_begin, strided_row,
+                      p, 0, d->col_comm, &requests[n++]);
+            bytes += (long long) (send_end - send_begin) * d->local_words * sizeof(uint64_t);
         }
+        if (recv_begin < recv_end)
+            MPI_Irecv(new_block + (size_t) (recv_begin - bounds[me]) * d->pitch, recv_end - recv_begin, strided_row,
+                      p, 0, d->col_comm, &requests[n++]);
+    }
+    MPI_Waitall(n, requests, MPI_STATUSES_IGNORE);
+    MPI_Type_free(&strided_row);
+    free(old_board);
+    profile_end(PROFILE_BALANCE, t, bytes);
+    return 1;
+}
 
+// Row strips of the board travel down process column 0, then each strip is
+// cut into blocks of columns along its process row. strip_counts/strip_offsets
+// and block_counts/block_offsets are in units of rows and words. The row
+// split is collected rather than recomputed, rebalancing may have moved it.
+static void board_layout(struct domain* d, int* strip_counts, int* strip_offsets,
+                         int* block_counts, int* block_offsets, MPI_Datatype* strip_column) {
+    int strip[2] = {d->local_rows * d->words, d->row_start * d->words}, strips[2 * d->dims[0]];
+    MPI_Allgather(strip, 2, MPI_INT, strips, 2, MPI_INT, d->col_comm);
+    for (int p = 0; p < d->dims[0]; p++) {
+        strip_counts[p] = strips[2 * p];
+        strip_offsets[p] = strips[2 * p + 1];
+    }
+    for (int q = 0; q < d->dims[1]; q++) {
+        block_counts[q] = split_count(d->words, d->dims[1], q);
+        block_offsets[q] = split_start(d->words, d->dims[1], q);
+    }
+    MPI_Datatype column;
+    MPI_Type_vector(d->local_rows, 1, d->words, MPI_UINT64_T, &column);
+    MPI_Type_create_resized(column, 0, sizeof(uint64_t), strip_column);
+    MPI_Type_commit(strip_column);
+    MPI_Type_free(&column);
+}
 
-        generation(local_swap_board, local_board, sendcounts[rank]/columns + 2, columns);
+void scatter_board(struct domain* d, uint64_t* board, uint64_t* local_board) {
+    int strip_counts[d->dims[0]], strip_offsets[d->dims[0]];
+    int block_counts[d->dims[1]], block_offsets[d->dims[1]];
+    MPI_Datatype strip_column;
+    uint64_t* strip = NULL;
+    board_layout(d, strip_counts, strip_offsets, block_counts, block_offsets, &strip_column);
 
-        swapBrd(&local_board, &local_swap_board);
+    if (d->coords[1] == 0) {
+        strip = malloc(sizeof(uint64_t) * d->local_rows * d->words);
+        MPI_Scatterv(board, strip_counts, strip_offsets, MPI_UINT64_T,
+                     strip, d->local_rows * d->words, MPI_UINT64_T, 0, d->col_comm);
+    }
+    MPI_Scatterv(strip, block_counts, block_offsets, strip_column,
+                 owned_block(d, local_board), d->local_words, d->column, 0, d->row_comm);
+
+    MPI_Type_free(&strip_column);
+    free(strip);
+}
+
+void gather_board(struct domain* d, uint64_t* board, uint64_t* local_board) {
+    int strip_counts[d->dims[0]], strip_offsets[d->dims[0]];
+    int block_counts[d->dims[1]], block_offsets[d->dims[1]];
+    MPI_Datatype strip_column;
+    uint64_t* strip = NULL;
+    board_layout(d, strip_counts, strip_offsets, block_counts, block_offsets, &strip_column);
 
+    if (d->coords[1] == 0) strip = malloc(sizeof(uint64_t) * d->local_rows * d->words);
+    MPI_Gatherv(owned_block(d, local_board), d->local_words, d->column,
+                strip, block_counts, block_offsets, strip_column, 0, d->row_comm);
+    if (d->coords[1] == 0) {
+        MPI_Gatherv(strip, d->local_rows * d->words, MPI_UINT64_T,
+                    board, strip_counts, strip_offsets, MPI_UINT64_T, 0, d->col_comm);
     }
-    MPI_Gatherv(local_board + columns, sendcounts[rank], MPI_INT, board, sendcounts, offsets, MPI_INT, 0, MPI_COMM_WORLD);
 
-    if (rank == 0) {
-    printf("Final board:\n");
-    write_board(board, rows, columns);
+    MPI_Type_free(&strip_column);
+    free(strip);
+}
+
+struct region halo_zone(struct domain* d, int dr, int dc, int send) {
+    // my outermost owned rows/words go out, the neighbour's land in the
+    // ghost zone on that side
+    int h = d->halo_rows, w = d->halo_words;
+    struct region z;
+    if (send) {
+        z.row_begin = dr > 0 ? d->local_rows : h;
+        z.word_begin = dc > 0 ? w + d->local_words - 1 : w;
+    }
+    else {
+        z.row_begin = dr < 0 ? 0 : (dr > 0 ? h + d->local_rows : h);
+        z.word_begin = dc < 0 ? w - 1 : (dc > 0 ? w + d->local_words : w);
     }
+    z.row_end = z.row_begin + (dr ? h : d->local_rows);
+    z.word_end = z.word_begin + (dc ? 1 : d->local_words);
+    return z;
+}
 
-    free(local_board);
-    free(board);
-    free(local_swap_board);
+// whether any tile overlapping z has its flag set in flags
+static int tiles_flagged(struct tiles* t, uint8_t* flags, struct region z) {
+    for (int tr = z.row_begin / TILE_ROWS; tr <= (z.row_end - 1) / TILE_ROWS; tr++)
+        for (int tc = z.word_begin / TILE_WORDS; tc <= (z.word_end - 1) / TILE_WORDS; tc++)
+            if (flags[tr * t->columns + tc]) return 1;
     return 0;
 }
 
-void swapBrd(int **new_board, int **old_board){
-    int *temp = *new_board;
-    *new_board = *old_board;
-    *old_board = temp;
+static void flag_tiles(struct tiles* t, uint8_t* flags, struct region z, uint8_t value) {
+    for (int tr = z.row_begin / TILE_ROWS; tr <= (z.row_end - 1) / TILE_ROWS; tr++)
+        for (int tc = z.word_begin / TILE_WORDS; tc <= (z.word_end - 1) / TILE_WORDS; tc++)
+            flags[tr * t->columns + tc] = value;
 }
 
-int* get_initial_board(int* rows, int* columns) {
-    int* board;
-    int i;
-    scanf("%d %d", rows, columns);
-    board = malloc(sizeof(int) * (*rows) * (*columns));
-    for (i = 0; i < (*rows) * (*columns); i++) {
-        scanf("%d", &(board[i]));
+// With active tiles an edge that has not changed since the last exchange
+// goes out as an empty message and the receiver keeps its ghost zone. That
+// only holds for zones the receiver recomputes exactly: with deep halos the
+// far end of the ghost word drifts, so those directions are always sent.
+static int halo_skippable(struct domain* d, int dc) {
+    return d->tiles && (dc == 0 || d->halo_words == 1);
+}
+
+// what is wrong with a board file of size bytes that starts with header,
+// or NULL if it is a board this program can hold
+static const char* board_problem(struct board_header* header, uint64_t size) {
+    if (memcmp(header->magic, BOARD_MAGIC, sizeof(header->magic)) != 0)
+        return "is not a binary board";
+    if (header->encoding != BOARD_ENCODING_PACKED64)
+        return "has an unknown encoding";
+    if (header->rows < 1 || header->columns < 1 || header->rows > INT_MAX || header->columns > INT_MAX)
+        return "has an unsupported size";
+    if (size < sizeof(*header) + header->rows * words_per_row(header->columns) * sizeof(uint64_t))
+        return "is truncated";
+    return NULL;
+}
+
+MPI_File open_board_file(MPI_Comm comm, const char* path, int* rows, int* columns) {
+    MPI_File file;
+    struct board_header header;
+    int rank;
+    const char* problem;
+    MPI_Offset size = 0;
+
+    MPI_Comm_rank(comm, &rank);
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot open board file %s\n", path);
+        MPI_Abort(comm, 1);
     }
-    return board;
+    memset(&header, 0, sizeof(header));
+    MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_get_size(file, &size);
+    problem = board_problem(&header, size);
+    if (problem) {
+        if (rank == 0) fprintf(stderr, "Board file %s %s\n", path, problem);
+        MPI_Abort(comm, 1);
+    }
+    *rows = header.rows;
+    *columns = header.columns;
+    return file;
 }
 
-void write_board(int* board, int rows, int columns) {
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < columns; j++) {
-            printf("%d\t", board[index1D(i, j, columns)]);
+// point file's view at my block of the board and return the type of the
+// owned block of a local board; empty ranks get a byte view and NULL type,
+// since they still have to join the collective calls
+static MPI_Datatype block_view(struct domain* d, MPI_File file) {
+    MPI_Datatype in_file, in_memory;
+    if (d->local_rows == 0) {
+        MPI_File_set_view(file, sizeof(struct board_header), MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+        return MPI_DATATYPE_NULL;
+    }
+
+    int file_sizes[2] = {d->rows, d->words};
+    int memory_sizes[2] = {d->local_rows + 2 * d->halo_rows, d->pitch};
+    int block[2] = {d->local_rows, d->local_words};
+    int file_start[2] = {d->row_start, d->word_start};
+    int memory_start[2] = {d->halo_rows, d->halo_words};
+    MPI_Type_create_subarray(2, file_sizes, block, file_start, MPI_ORDER_C, MPI_UINT64_T, &in_file);
+    MPI_Type_create_subarray(2, memory_sizes, block, memory_start, MPI_ORDER_C, MPI_UINT64_T, &in_memory);
+    MPI_Type_commit(&in_file);
+    MPI_Type_commit(&in_memory);
+    MPI_File_set_view(file, sizeof(struct board_header), MPI_UINT64_T, in_file, "native", MPI_INFO_NULL);
+    MPI_Type_free(&in_file);
+    return in_memory;
+}
+
+void read_board_block(struct domain* d, MPI_File file, uint64_t* local_board) {
+    MPI_Datatype in_memory = block_view(d, file);
+    if (in_memory == MPI_DATATYPE_NULL) {
+        MPI_File_read_all(file, local_board, 0, MPI_BYTE, MPI_STATUS_IGNORE);
+        return;
+    }
+    MPI_File_read_all(file, local_board, 1, in_memory, MPI_STATUS_IGNORE);
+    MPI_Type_free(&in_memory);
+}
+
+void write_board_block(struct domain* d, MPI_File file, uint64_t* local_board) {
+    MPI_Datatype in_memory = block_view(d, file);
+    if (in_memory == MPI_DATATYPE_NULL) {
+        MPI_File_write_all(file, local_board, 0, MPI_BYTE, MPI_STATUS_IGNORE);
+        return;
+    }
+    MPI_File_write_all(file, local_board, 1, in_memory, MPI_STATUS_IGNORE);
+    MPI_Type_free(&in_memory);
+}
+
+MPI_File create_board_file(MPI_Comm comm, const char* path, int rows, int columns) {
+    MPI_File file;
+    struct board_header header;
+    int rank;
+
+    MPI_Comm_rank(comm, &rank);
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot create board file %s\n", path);
+        MPI_Abort(comm, 1);
+    }
+    // drops whatever an older, larger file left past the end
+    MPI_File_set_size(file, sizeof(header) + (MPI_Offset) rows * words_per_row(columns) * sizeof(uint64_t));
+    if (rank == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BOARD_MAGIC, sizeof(header.magic));
+        header.encoding = BOARD_ENCODING_PACKED64;
+        header.rows = rows;
+        header.columns = columns;
+        MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    return file;
+}
+
+void write_board_file(MPI_File file, uint64_t* board, int rows, int columns) {
+    int words = words_per_row(columns);
+    for (int i = 0; i < rows; i++)
+        MPI_File_write_at(file, sizeof(struct board_header) + (MPI_Offset) i * words * sizeof(uint64_t),
+                          board + (size_t) i * words, words, MPI_UINT64_T, MPI_STATUS_IGNORE);
+}
+
+// bytes [begin, end) of file, NUL terminated
+static char* read_slice(MPI_File file, MPI_Offset begin, MPI_Offset end) {
+    char* text = malloc(end - begin + 1);
+    MPI_File_read_at(file, begin, text, (int) (end - begin), MPI_CHAR, MPI_STATUS_IGNORE);
+    text[end - begin] = '\0';
+    return text;
+}
+
+static void add_run(struct pattern* p, int* capacity, int row, int column, int length) {
+    if (p->count == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 1024;
+        p->runs = realloc(p->runs, *capacity * sizeof(struct run));
+    }
+    p->runs[p->count].row = row;
+    p->runs[p->count].column = column;
+    p->runs[p->count].length = length;
+    p->count++;
+}
+
+// Parse the RLE tokens that start in text[first, last) (text[0] is the
+// byte before first, or first itself at the start of the data). Runs on
+// the slice's first line have columns relative to wherever the previous
+// slices left off; advance gets the rows and columns this slice moves on.
+// Returns 0 if a token runs past the end of text.
+static int parse_rle_slice(char* text, long length, long first, long last, struct pattern* p, long* advance) {
+    int capacity = 0;
+    long row = 0, column = 0, i = first;
+    p->count = 0;
+    // the slice before owns a token whose count straddles the boundary
+    if (first > 0 && text[first - 1] >= '0' && text[first - 1] <= '9') {
+        while (i < length && text[i] >= '0' && text[i] <= '9') i++;
+        i++;
+    }
+    while (1) {
+        while (i < length && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n')) i++;
+        if (i >= last) break;
+        long count = 0;
+        int counted = 0;
+        while (i < length && text[i] >= '0' && text[i] <= '9') {
+            count = count * 10 + (text[i++] - '0');
+            counted = 1;
+        }
+        if (i >= length) return 0;
+        if (!counted) count = 1;
+        char tag = text[i++];
+        if (tag == '!') break;
+        if (tag == '$') {
+            row += count;
+            column = 0;
+        }
+        else if (tag == 'b' || tag == '.') {
+            column += count;
+        }
+        else if ((tag >= 'a' && tag <= 'z') || (tag >= 'A' && tag <= 'Z')) {
+            // o, or any live state of a multi-state pattern
+            add_run(p, &capacity, row, column, count);
+            column += count;
         }
-        printf("\n");
     }
+    advance[0] = row;
+    advance[1] = column;
+    return 1;
 }
 
-void generation(int* new_board, int* old_board, int rows, int columns) {
-    for (int i=0; i < rows; i++) {
-        for (int j=0; j < columns; j++) {
-            new_board[index1D(i, j, columns)] =
-                next_value(old_board[index1D(i, j, columns)],
-                    count_neighbors(old_board, i, j, rows, columns));
+// Parse the Life 1.06 lines ("x y") that start in text[first, last).
+// Returns 0 if a line runs past the end of text and text does not end
+// the file.
+static int parse_106_slice(char* text, long length, long first, long last, int at_end, struct pattern* p) {
+    int capacity = 0, x, y;
+    long i = first;
+    p->count = 0;
+    if (first > 0 && text[first - 1] != '\n')
+        while (i < length && text[i] != '\n') i++;
+    while (i < last) {
+        if (text[i] == '\n') {
+            i++;
+            continue;
+        }
+        char* end = memchr(text + i, '\n', length - i);
+        if (!end) {
+            if (!at_end) return 0;
+            end = text + length;
         }
+        if (text[i] != '#' && sscanf(text + i, "%d %d", &x, &y) == 2) add_run(p, &capacity, y, x, 1);
+        i = end - text + 1;
     }
+    return 1;
 }
 
-int count_neighbors(int* board, int r, int c, int rows, int columns) {
-    int neighbors = 0;
+// the rule of an RLE header, B3/S23 or the older S/B form 23/3, which is
+// always radius 1; 0 if parse_rule() cannot read it
+static int pattern_rule(char* text, struct rule* r) {
+    char swapped[64];
+    char* slash = strchr(text, '/');
+    if (slash && strspn(text, "012345678/") == strlen(text)) {
+        snprintf(swapped, sizeof(swapped), "B%s/S%.*s", slash + 1, (int) (slash - text), text);
+        return parse_rule(swapped, 1, r);
+    }
+    return parse_rule(text, 1, r);
+}
+
+// (rows, column) moves of consecutive slices chain like cursor motions:
+// once a slice starts a new row, the column before it no longer matters
+static void chain_advance(void* in, void* inout, int* len, MPI_Datatype* type) {
+    long* before = in;
+    long* after = inout;
+    (void) type;
+    for (int i = 0; i < *len; i++, before += 2, after += 2) {
+        if (after[0] == 0) after[1] += before[1];
+        after[0] += before[0];
+    }
+}
 
-    // Top left
-    if (r != 0 && c != 0)
-       neighbors += board[index1D(r - 1, c - 1, columns)];
-    // Top middle
-    if (r != 0)
-       neighbors += board[index1D(r - 1, c, columns)];
-    // Top right
-    if (r != 0 && c != columns - 1)
-       neighbors += board[index1D(r - 1, c + 1, columns)];
-    // Middle left
-    if (c != 0)
-       neighbors += board[index1D(r, c - 1, columns)];
-    // Middle right
-    if (c != columns - 1)
-       neighbors += board[index1D(r, c + 1, columns)];
-    // Bottom left
-    if (r != rows - 1 && c != 0)
-       neighbors += board[index1D(r + 1, c - 1, columns)];
-    // Bottom middle 
-    if (r != rows - 1)
-       neighbors += board[index1D(r + 1, c, columns)];
-    // Bottom right 
-    if (r != rows - 1)
-       neighbors += board[index1D(r + 1, c + 1, columns)];
+void read_pattern(MPI_Comm comm, const char* path, struct pattern* p) {
+    MPI_File file;
+    MPI_Offset size;
+    // format, width, height, offset of the data; format -1 flags a bad file
+    long long info[4] = {-1, 0, 0, 0};
+    int rank, ranks;
+    char line[4096];
 
-    return neighbors;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot open pattern file %s\n", path);
+        MPI_Abort(comm, 1);
+    }
+    MPI_File_get_size(file, &size);
+
+    // the header is short, rank 0 reads it and tells everyone where the
+    // cells start
+    if (rank == 0) {
+        FILE* header = fopen(path, "r");
+        char rule_text[64] = "B3/S23";
+        while (header && fgets(line, sizeof(line), header)) {
+            if (strncmp(line, "#Life 1.06", 10) == 0) {
+                info[0] = PATTERN_LIFE_106;
+                break;
+            }
+            if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+            if (sscanf(line, " x = %lld , y = %lld , rule = %63s", &info[1], &info[2], rule_text) >= 2
+                && info[1] > 0 && info[2] > 0 && info[1] <= INT_MAX && info[2] <= INT_MAX) {
+                struct rule header_rule;
+                if (!pattern_rule(rule_text, &header_rule))
+                    fprintf(stderr, "Pattern rule %s is not supported\n", rule_text);
+                else {
+                    info[0] = PATTERN_RLE;
+                    if (rule.radius != 1 || memcmp(header_rule.next, rule.next, sizeof(rule.next)) != 0)
+                        fprintf(stderr, "Pattern rule %s differs from --rule %s, running %s\n",
+                                rule_text, rule.text, rule.text);
+                }
+            }
+            else fprintf(stderr, "Pattern file %s has no RLE header\n", path);
+            break;
+        }
+        if (header) {
+            info[3] = ftell(header);
+            fclose(header);
+        }
+    }
+    MPI_Bcast(info, 4, MPI_LONG_LONG, 0, comm);
+    if (info[0] < 0) MPI_Abort(comm, 1);
+
+    // my slice of the data, plus a little on each side for the tokens that
+    // straddle its ends; grown if a token turns out longer
+    MPI_Offset data = info[3];
+    MPI_Offset first = data + (size - data) * rank / ranks;
+    MPI_Offset last = data + (size - data) * (rank + 1) / ranks;
+    MPI_Offset begin = first > data ? first - 1 : first;
+    long advance[2] = {0, 0};
+    p->runs = NULL;
+    p->count = 0;
+
+    // nothing after the first '!' is part of an RLE pattern
+    if (info[0] == PATTERN_RLE) {
+        long long stop = LLONG_MAX;
+        char* text = read_slice(file, first, last);
+        char* bang = memchr(text, '!', last - first);
+        if (bang) stop = first + (bang - text);
+        free(text);
+        MPI_Allreduce(MPI_IN_PLACE, &stop, 1, MPI_LONG_LONG, MPI_MIN, comm);
+        if (last > stop) last = stop > first ? stop : first;
+    }
+    for (MPI_Offset extra = 256; ; extra *= 2) {
+        MPI_Offset end = last + extra < size ? last + extra : size;
+        char* text = read_slice(file, begin, end);
+        int done = info[0] == PATTERN_RLE
+                   ? parse_rle_slice(text, end - begin, first - begin, last - begin, p, advance)
+                   : parse_106_slice(text, end - begin, first - begin, last - begin, end == size, p);
+        free(text);
+        if (done || end == size) break;
+    }
+    MPI_File_close(&file);
+
+    if (info[0] == PATTERN_RLE) {
+        // where each slice starts is everything before it, chained
+        long start[2] = {0, 0};
+        MPI_Op chain;
+        MPI_Datatype pair;
+        MPI_Type_contiguous(2, MPI_LONG, &pair);
+        MPI_Type_commit(&pair);
+        MPI_Op_create(chain_advance, 0, &chain);
+        MPI_Exscan(advance, start, 1, pair, chain, comm);
+        MPI_Op_free(&chain);
+        MPI_Type_free(&pair);
+        if (rank == 0) start[0] = start[1] = 0;
+        for (int i = 0; i < p->count; i++) {
+            if (p->runs[i].row == 0) p->runs[i].column += start[1];
+            p->runs[i].row += start[0];
+        }
+        p->rows = info[2];
+        p->columns = info[1];
+    }
+    else {
+        // cell lists have no size, their bounding box is the pattern
+        int low[2] = {INT_MAX, INT_MAX}, high[2] = {INT_MIN, INT_MIN};
+        for (int i = 0; i < p->count; i++) {
+            if (p->runs[i].row < low[0]) low[0] = p->runs[i].row;
+            if (p->runs[i].column < low[1]) low[1] = p->runs[i].column;
+            if (p->runs[i].row > high[0]) high[0] = p->runs[i].row;
+            if (p->runs[i].column > high[1]) high[1] = p->runs[i].column;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, low, 2, MPI_INT, MPI_MIN, comm);
+        MPI_Allreduce(MPI_IN_PLACE, high, 2, MPI_INT, MPI_MAX, comm);
+        if (low[0] > high[0]) low[0] = low[1] = high[0] = high[1] = 0;
+        for (int i = 0; i < p->count; i++) {
+            p->runs[i].row -= low[0];
+            p->runs[i].column -= low[1];
+        }
+        p->rows = high[0] - low[0] + 1;
+        p->columns = high[1] - low[1] + 1;
+    }
 }
 
+void free_pattern(struct pattern* p) {
+    free(p->runs);
+    p->runs = NULL;
+    p->count = 0;
+}
 
-int next_value(int cur_val, int neighbors) {
-   // Given a cell's current value (1 or 0) and its number of live
-   // neighbors (0-8), return its next value
-   assert(cur_val == 0 || cur_val == 1);
-   assert(neighbors >= 0 && neighbors <= 8);
+// set bits [begin, begin + n) of a packed row
+static void set_bits(uint64_t* row, long begin, long n) {
+    for (long end = begin + n; begin < end; ) {
+        int bit = begin % CELLS_PER_WORD;
+        int take = CELLS_PER_WORD - bit < end - begin ? CELLS_PER_WORD - bit : (int) (end - begin);
+        row[begin / CELLS_PER_WORD] |= (take == CELLS_PER_WORD ? ~(uint64_t) 0 : (((uint64_t) 1 << take) - 1)) << bit;
+        begin += take;
+    }
+}
+
+// the piece of split_count(n, parts, ...) that item i falls in
+static int split_owner(int n, int parts, int i) {
+    int big = n / parts + 1, extra = n % parts;
+    return i < extra * big ? i / big : extra + (i - extra * big) / (n / parts);
+}
+
+// move run r by offset and trim it to the board; 0 if nothing is left
+static int clip_run(struct run* r, int* offset, int rows, int columns) {
+    r->row += offset[0];
+    r->column += offset[1];
+    if (r->column < 0) {
+        r->length += r->column;
+        r->column = 0;
+    }
+    if (r->column + r->length > columns) r->length = columns - r->column;
+    return r->row >= 0 && r->row < rows && r->length > 0;
+}
+
+void place_pattern(struct domain* d, struct pattern* p, int* offset, uint64_t* local_board) {
+    int ranks = d->dims[0] * d->dims[1];
+    int send_counts[ranks], send_offsets[ranks], recv_counts[ranks], recv_offsets[ranks];
+    int pieces = 0, received = 0;
+    struct run* send = NULL;
+    struct run* recv;
+
+    // split every run at the block columns and count what goes where
+    for (int pass = 0; pass < 2; pass++) {
+        memset(send_counts, 0, sizeof(send_counts));
+        for (int i = 0; i < p->count; i++) {
+            struct run r = p->runs[i];
+            if (!clip_run(&r, offset, d->rows, d->columns)) continue;
+            int coords[2] = {split_owner(d->rows, d->dims[0], r.row), 0};
+            while (r.length > 0) {
+                int owner, block_end;
+                coords[1] = split_owner(d->words, d->dims[1], r.column / CELLS_PER_WORD);
+                block_end = (split_start(d->words, d->dims[1], coords[1])
+                             + split_count(d->words, d->dims[1], coords[1])) * CELLS_PER_WORD;
+                MPI_Cart_rank(d->cart, coords, &owner);
+                struct run piece = {r.row, r.column, block_end - r.column < r.length ? block_end - r.column : r.length};
+                if (pass == 1) send[send_offsets[owner] + send_counts[owner]] = piece;
+                send_counts[owner]++;
+                r.column += piece.length;
+                r.length -= piece.length;
+            }
+        }
+        if (pass == 0) {
+            for (int i = 0; i < ranks; i++) {
+                send_offsets[i] = pieces;
+                pieces += send_counts[i];
+            }
+            send = malloc((pieces ? pieces : 1) * sizeof(struct run));
+        }
+    }
+
+    // runs travel as three ints each
+    for (int i = 0; i < ranks; i++) {
+        send_counts[i] *= 3;
+        send_offsets[i] *= 3;
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, d->cart);
+    for (int i = 0; i < ranks; i++) {
+        recv_offsets[i] = received;
+        received += recv_counts[i];
+    }
+    recv = malloc((received ? received : 1) * sizeof(int));
+    MPI_Alltoallv(send, send_counts, send_offsets, MPI_INT, recv, recv_counts, recv_offsets, MPI_INT, d->cart);
 
-   if (neighbors < 2) return 0;  // dies from isolation if alive
-   if (neighbors == 2) return cur_val; // keep current state
-   if (neighbors == 3) return 1; // survives if alive; spawns if dead
-   return 0;  // 4+ neighbors => dead
+    for (int i = 0; i < received / 3; i++) {
+        uint64_t* row = local_board + (size_t) (recv[i].row - d->row_start + d->halo_rows) * d->pitch;
+        set_bits(row, recv[i].column - (long) (d->word_start - d->halo_words) * CELLS_PER_WORD, recv[i].length);
+    }
+    free(send);
+    free(recv);
 }
 
+uint64_t* gather_pattern(MPI_Comm comm, struct pattern* p, int* offset, int rows, int columns) {
+    int rank, ranks, count = 0, total = 0;
+    uint64_t* board = NULL;
+    struct run* all = NULL;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+    int counts[ranks], offsets[ranks];
+
+    for (int i = 0; i < p->count; i++) {
+        struct run r = p->runs[i];
+        if (clip_run(&r, offset, rows, columns)) p->runs[count++] = r;
+    }
+    p->count = count;
+    count *= 3;
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        for (int i = 0; i < ranks; i++) {
+            offsets[i] = total;
+            total += counts[i];
+        }
+        all = malloc((total ? total : 1) * sizeof(int));
+    }
+    MPI_Gatherv(p->runs, count, MPI_INT, all, counts, offsets, MPI_INT, 0, comm);
+    if (rank == 0) {
+        int words = words_per_row(columns);
+        board = calloc((size_t) rows * words, sizeof(uint64_t));
+        for (int i = 0; i < total / 3; i++) set_bits(board + (size_t) all[i].row * words, all[i].column, all[i].length);
+    }
+    free(all);
+    return board;
+}
+
+void setup_stop(struct stop* s, int period, long long start) {
+    memset(s, 0, sizeof(*s));
+    s->period = period;
+    s->start = s->first = start;
+    s->request = MPI_REQUEST_NULL;
+    s->stable = -1;
+    if (period) s->history = malloc((period + 1) * sizeof(uint64_t));
+}
+
+// the hash of the owned cells in region r; empty words add nothing, which
+// keeps sparse boards cheap
+static uint64_t hash_region(struct domain* d, uint64_t* local_board, struct region r) {
+    uint64_t h = 0;
+    if (r.row_begin < d->halo_rows) r.row_begin = d->halo_rows;
+    if (r.row_end > d->halo_rows + d->local_rows) r.row_end = d->halo_rows + d->local_rows;
+    if (r.word_begin < d->halo_words) r.word_begin = d->halo_words;
+    if (r.word_end > d->halo_words + d->local_words) r.word_end = d->halo_words + d->local_words;
+    for (int i = r.row_begin; i < r.row_end; i++) {
+        uint64_t* row = local_board + (size_t) i * d->pitch;
+        uint64_t index = (uint64_t) (d->row_start + i - d->halo_rows) * d->words + d->word_start - d->halo_words;
+        for (int j = r.word_begin; j < r.word_end; j++)
+            if (row[j]) h += mix64(row[j] ^ ((index + j) * 0x9e3779b97f4a7c15ULL));
+    }
+    return h;
+}
+
+void hash_generation(struct stop* s, struct domain* d, uint64_t* local_board) {
+    struct tiles* t = d->tiles;
+    uint64_t h = 0;
+    double begin = profile_begin();
+    if (!t) {
+        #pragma omp parallel for schedule(static) reduction(+:h)
+        for (int i = d->halo_rows; i < d->halo_rows + d->local_rows; i++) {
+            struct region row = {i, i + 1, d->halo_words, d->halo_words + d->local_words};
+            h += hash_region(d, local_board, row);
+        }
+        s->pending[s->pending_count++] = h;
+        profile_end(PROFILE_HASH, begin, 0);
+        return;
+    }
+    // with active tiles only the tiles that changed are hashed again; all
+    // of them are marked changed before the first generation
+    if (!s->tile_hash) s->tile_hash = calloc((size_t) t->rows * t->columns, sizeof(uint64_t));
+    #pragma omp parallel for schedule(static) reduction(+:h)
+    for (int tr = 0; tr < t->rows; tr++) {
+        for (int tc = 0; tc < t->columns; tc++) {
+            int i = tr * t->columns + tc;
+            if (!t->changed[i]) continue;
+            struct region tile = {tr * TILE_ROWS, (tr + 1) * TILE_ROWS, tc * TILE_WORDS, (tc + 1) * TILE_WORDS};
+            uint64_t tile_hash = hash_region(d, local_board, tile);
+            h += tile_hash - s->tile_hash[i];
+            s->tile_hash[i] = tile_hash;
+        }
+    }
+    s->total += h;
+    s->pending[s->pending_count++] = s->total;
+    profile_end(PROFILE_HASH, begin, 0);
+}
+
+// go through the generations of a completed reduction in order, so the
+// first repeat found is the start of the cycle and the shortest period
+static void stop_reduced(struct stop* s, uint64_t* hashes, long long first, int count) {
+    for (int i = 0; i < count && !s->cycle; i++) {
+        long long gen = first + i;
+        for (int p = 1; p <= s->period && !s->cycle; p++) {
+            if (gen - p >= s->start && s->history[(gen - p) % (s->period + 1)] == hashes[i]) {
+                s->stable = gen - p;
+                s->cycle = p;
+            }
+        }
+        s->history[gen % (s->period + 1)] = hashes[i];
+    }
+}
+
+int check_stop(struct stop* s) {
+    if (s->sent_count) {
+        // the previous batch is only looked at when the next one is due, as
+        // the generation it completes at would differ from rank to rank
+        if (s->pending_count < STOP_BATCH) {
+            int done;
+            MPI_Test(&s->request, &done, MPI_STATUS_IGNORE);
+            return 0;
+        }
+        MPI_Wait(&s->request, MPI_STATUS_IGNORE);
+        stop_reduced(s, s->reduced, s->sent_first, s->sent_count);
+        s->sent_count = 0;
+        if (s->cycle) {
+            s->period = 0;
+            return 1;
+        }
+    }
+    if (s->pending_count >= STOP_BATCH) {
+        memcpy(s->sent, s->pending, s->pending_count * sizeof(uint64_t));
+        s->sent_first = s->first;
+        s->sent_count = s->pending_count;
+        s->first += s->pending_count;
+        s->pending_count = 0;
+        MPI_Iallreduce(s->sent, s->reduced, s->sent_count, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD, &s->request);
+    }
+    return 0;
+}
+
+void retile_stop(struct stop* s) {
+    free(s->tile_hash);
+    s->tile_hash = NULL;
+    s->total = 0;
+}
+
+void finish_stop(struct stop* s) {
+    if (s->sent_count) {
+        MPI_Wait(&s->request, MPI_STATUS_IGNORE);
+        stop_reduced(s, s->reduced, s->sent_first, s->sent_count);
+    }
+    if (s->period && !s->cycle && s->pending_count) {
+        MPI_Allreduce(s->pending, s->reduced, s->pending_count, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+        stop_reduced(s, s->reduced, s->first, s->pending_count);
+    }
+    free(s->history);
+    free(s->tile_hash);
+    s->history = NULL;
+    s->tile_hash = NULL;
+}
+
+void setup_checkpoint(struct checkpoint* c, long long start) {
+    c->last = start;
+    c->last_time = MPI_Wtime();
+    // time-based intervals are turned into a generation count so that every
+    // rank stops at the same generation; the first estimate comes from a
+    // few timed generations
+    c->next = start + (c->every ? c->every : CHECKPOINT_CALIBRATION);
+    c->snapshot = NULL;
+}
+
+static char* checkpoint_path(const char* prefix, long long gen) {
+    char* path = malloc(strlen(prefix) + 32);
+    sprintf(path, "%s.%lld.bin", prefix, gen);
+    return path;
+}
+
+void finish_checkpoint(struct checkpoint* c) {
+    int rank;
+    if (c->writing < 0) return;
+    MPI_Wait(&c->request, MPI_STATUS_IGNORE);
+    MPI_File_close(&c->file);
+    // every rank's part is on disk once all of them have closed the file
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+        char* latest = malloc(strlen(c->prefix) + 16);
+        char* staged = malloc(strlen(c->prefix) + 16);
+        char* path = checkpoint_path(c->prefix, c->writing);
+        sprintf(latest, "%s.latest", c->prefix);
+        sprintf(staged, "%s.latest.tmp", c->prefix);
+        FILE* f = fopen(staged, "w");
+        if (f) {
+            fprintf(f, "%lld %s\n", c->writing, path);
+            fclose(f);
+            rename(staged, latest);
+        }
+        else {
+            fprintf(stderr, "Cannot write %s\n", staged);
+        }
+        // the one before is no longer needed
+        if (c->complete >= 0) {
+            char* old = checkpoint_path(c->prefix, c->complete);
+            remove(old);
+            free(old);
+        }
+        free(path);
+        free(latest);
+        free(staged);
+    }
+    c->complete = c->writing;
+    c->writing = -1;
+}
+
+void checkpoint(struct checkpoint* c, struct domain* d, uint64_t* local_board, long long gen) {
+    if (gen < c->next) {
+        // keep the write in flight moving
+        if (c->writing >= 0) {
+            int done;
+            MPI_Test(&c->request, &done, MPI_STATUS_IGNORE);
+            if (done) c->request = MPI_REQUEST_NULL;
+        }
+        return;
+    }
+
+    // how long the slowest rank took per generation since the last one
+    double per_generation = (MPI_Wtime() - c->last_time) / (gen - c->last);
+    MPI_Allreduce(MPI_IN_PLACE, &per_generation, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    long long interval = c->every;
+    if (c->seconds) {
+        long long timed = per_generation > 0 ? (long long) (c->seconds / per_generation) : LLONG_MAX / 2;
+        if (timed < 1) timed = 1;
+        if (!interval || timed < interval) interval = timed;
+    }
+    int calibrating = !c->every && c->last == c->next - CHECKPOINT_CALIBRATION && c->complete < 0 && c->writing < 0;
+    c->last = gen;
+    c->last_time = MPI_Wtime();
+    c->next = gen + interval;
+    if (calibrating) {
+        c->next = gen + (interval > CHECKPOINT_CALIBRATION ? interval - CHECKPOINT_CALIBRATION : 1);
+        return;
+    }
+
+    double t = profile_begin();
+    finish_checkpoint(c);
+    // the board moves on while the write runs, so it writes from a copy,
+    // sized afresh as rebalancing may have changed the block
+    c->snapshot = realloc(c->snapshot, ((size_t) d->local_rows * d->local_words + 1) * sizeof(uint64_t));
+    for (int i = 0; i < d->local_rows; i++)
+        memcpy(c->snapshot + (size_t) i * d->local_words, owned_block(d, local_board) + (size_t) i * d->pitch,
+               d->local_words * sizeof(uint64_t));
+    char* path = checkpoint_path(c->prefix, gen);
+    c->file = create_board_file(MPI_COMM_WORLD, path, d->rows, d->columns);
+    free(path);
+    MPI_Datatype in_memory = block_view(d, c->file);
+    if (in_memory != MPI_DATATYPE_NULL) MPI_Type_free(&in_memory);
+    MPI_File_iwrite_all(c->file, c->snapshot, d->local_rows ? d->local_rows * d->local_words : 0,
+                        d->local_rows ? MPI_UINT64_T : MPI_BYTE, &c->request);
+    c->writing = gen;
+    profile_end(PROFILE_CHECKPOINT, t, (long long) d->local_rows * d->local_words * sizeof(uint64_t));
+}
+
+char* latest_checkpoint(MPI_Comm comm, const char* prefix, long long* gen) {
+    int rank, length = 0;
+    char* path = NULL;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0) {
+        char* latest = malloc(strlen(prefix) + 16);
+        FILE* f;
+        sprintf(latest, "%s.latest", prefix);
+        path = malloc(strlen(prefix) + 4096);
+        if ((f = fopen(latest, "r")) && fscanf(f, "%lld %4095s", gen, path) == 2) length = strlen(path) + 1;
+        if (f) fclose(f);
+        free(latest);
+    }
+    MPI_Bcast(&length, 1, MPI_INT, 0, comm);
+    MPI_Bcast(gen, 1, MPI_LONG_LONG, 0, comm);
+    if (length == 0) {
+        free(path);
+        return NULL;
+    }
+    if (rank != 0) path = malloc(length);
+    MPI_Bcast(path, length, MPI_CHAR, 0, comm);
+    return path;
+}
+
+// the encoding thread: waits for a slot, encodes it, says it is done
+static void* stream_worker(void* arg) {
+    struct stream* s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->pending < 0 && !s->quit) pthread_cond_wait(&s->wake, &s->lock);
+        if (s->pending < 0) break;
+        struct stream_slot* slot = &s->slot[s->pending];
+        pthread_mutex_unlock(&s->lock);
+
+        // rank 0 leads the frame with its header
+        uint8_t* out = slot->packed;
+        if (s->rank == 0) {
+            uint64_t frame[2] = {slot->generation, s->ranks};
+            memcpy(out, frame, sizeof(frame));
+            out += sizeof(frame);
+        }
+        uint8_t* chunk = out;
+        out += sizeof(slot->chunk);
+        size_t words = slot->chunk[1] * slot->chunk[3];
+        for (size_t w = 0; w < words; ) {
+            uint32_t run[2] = {0, 0};
+            while (w < words && !slot->staged[w]) w++, run[0]++;
+            size_t literal = w;
+            while (w < words && slot->staged[w]) w++, run[1]++;
+            memcpy(out, run, sizeof(run));
+            memcpy(out + sizeof(run), slot->staged + literal, run[1] * sizeof(uint64_t));
+            out += sizeof(run) + run[1] * sizeof(uint64_t);
+        }
+        slot->chunk[4] = out - chunk - sizeof(slot->chunk);
+        memcpy(chunk, slot->chunk, sizeof(slot->chunk));
+        slot->packed_bytes = out - slot->packed;
+
+        pthread_mutex_lock(&s->lock);
+        s->pending = -1;
+        pthread_cond_broadcast(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// block until the thread has encoded whatever it was given
+static void stream_idle(struct stream* s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->pending >= 0) pthread_cond_wait(&s->wake, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// append an encoded frame: the chunks go one after another in rank order
+static void write_frame(struct stream* s, struct stream_slot* slot) {
+    long long bytes = slot->packed_bytes, before = 0, total;
+    MPI_Exscan(&bytes, &before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (s->rank == 0) before = 0;
+    MPI_Allreduce(&bytes, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    MPI_File_iwrite_at_all(s->file, s->end + before, slot->packed, bytes, MPI_BYTE, &slot->write);
+    if (s->rank == 0) {
+        long long frame = s->frames - 1;
+        if (frame % 64 == 0) s->index = realloc(s->index, (frame + 64) * 3 * sizeof(uint64_t));
+        s->index[3 * frame] = slot->generation;
+        s->index[3 * frame + 1] = s->end;
+        s->index[3 * frame + 2] = total;
+    }
+    s->end += total;
+}
+
+void setup_stream(struct stream* s, struct domain* d, long long start) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &s->ranks);
+    s->rank = rank;
+    s->next = (start + s->every - 1) / s->every * s->every;
+    s->frames = 0;
+    s->index = NULL;
+    s->pending = -1;
+    s->quit = 0;
+    memset(s->slot, 0, sizeof(s->slot));
+    s->slot[0].write = s->slot[1].write = MPI_REQUEST_NULL;
+    if (MPI_File_open(MPI_COMM_WORLD, s->path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &s->file)
+        != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot create snapshot stream %s\n", s->path);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size(s->file, 0);
+    if (rank == 0) {
+        struct board_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STREAM_MAGIC, sizeof(header.magic));
+        header.encoding = STREAM_ENCODING_RLE64;
+        header.rows = d->rows;
+        header.columns = d->columns;
+        MPI_File_write_at(s->file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    s->end = sizeof(struct board_header);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->wake, NULL);
+    pthread_create(&s->thread, NULL, stream_worker, s);
+}
+
+void snapshot(struct stream* s, struct domain* d, uint64_t* local_board, long long gen) {
+    if (gen != s->next) return;
+    double t = profile_begin();
+    struct stream_slot* slot = &s->slot[s->frames % 2];
+    size_t words = (size_t) d->local_rows * d->local_words;
+
+    // the thread has had a whole interval for the last frame, and the
+    // write of the one before, which used this slot, has had two
+    stream_idle(s);
+    MPI_Wait(&slot->write, MPI_STATUS_IGNORE);
+    if (words > slot->staged_capacity) {
+        slot->staged = realloc(slot->staged, words * sizeof(uint64_t));
+        slot->staged_capacity = words;
+    }
+    // runs of one word each cost an extra word apiece at worst
+    size_t worst = sizeof(uint64_t) * (2 + CHUNK_FIELDS + 2 * words + 1);
+    if (worst > slot->packed_capacity) {
+        slot->packed = realloc(slot->packed, worst);
+        slot->packed_capacity = worst;
+    }
+    for (int i = 0; i < d->local_rows; i++)
+        memcpy(slot->staged + (size_t) i * d->local_words, owned_block(d, local_board) + (size_t) i * d->pitch,
+               d->local_words * sizeof(uint64_t));
+    slot->generation = gen;
+    slot->chunk[0] = d->row_start;
+    slot->chunk[1] = d->local_rows;
+    slot->chunk[2] = d->word_start;
+    slot->chunk[3] = d->local_words;
+
+    pthread_mutex_lock(&s->lock);
+    s->pending = s->frames % 2;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    // the frame before this one is encoded by now and can go out
+    if (s->frames > 0) write_frame(s, &s->slot[(s->frames - 1) % 2]);
+    s->frames++;
+    s->next += s->every;
+    profile_end(PROFILE_SNAPSHOT, t, words * sizeof(uint64_t));
+}
+
+void finish_stream(struct stream* s) {
+    stream_idle(s);
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    if (s->frames > 0) {
+        // write_frame() indexes the last frame staged
+        write_frame(s, &s->slot[(s->frames - 1) % 2]);
+    }
+    for (int i = 0; i < 2; i++) {
+        MPI_Wait(&s->slot[i].write, MPI_STATUS_IGNORE);
+        free(s->slot[i].staged);
+        free(s->slot[i].packed);
+    }
+    if (s->rank == 0) {
+        uint64_t trailer[3] = {s->frames, s->end, 0};
+        memcpy(&trailer[2], STREAM_INDEX_MAGIC, sizeof(uint64_t));
+        MPI_File_write_at(s->file, s->end, s->index, s->frames * 3, MPI_UINT64_T, MPI_STATUS_IGNORE);
+        MPI_File_write_at(s->file, s->end + s->frames * 3 * sizeof(uint64_t), trailer, 3, MPI_UINT64_T,
+                          MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&s->file);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->wake);
+    free(s->index);
+}
+
+static const char* profile_names[PROFILE_PARTS] = {
+    "input", "scatter", "halo start", "interior", "halo wait", "boundary", "steps", "hash",
+    "checkpoint", "snapshot", "balance", "gather", "output"
+};
+
+void start_profile(const char* trace_path) {
+    memset(&profile, 0, sizeof(profile));
+    profile.on = 1;
+    profile.trace_path = trace_path;
+    if (trace_path) profile.events = malloc(TRACE_EVENTS * sizeof(struct trace_event));
+    // lines the ranks' clocks up closely enough for a timeline
+    MPI_Barrier(MPI_COMM_WORLD);
+    profile.origin = MPI_Wtime();
+}
+
+void profile_record(int part, double begin, long long bytes) {
+    double end = MPI_Wtime();
+    profile.time[part] += end - begin;
+    profile.calls[part]++;
+    profile.bytes[part] += bytes;
+    if (profile.events && profile.event_count < TRACE_EVENTS) {
+        struct trace_event e = {part, begin - profile.origin, end - profile.origin, bytes};
+        profile.events[profile.event_count++] = e;
+    }
+}
+
+// every rank formats its own events and they go out in rank order; rank 0
+// opens the array and the last rank closes it
+static void write_trace(void) {
+    int rank, size;
+    MPI_File file;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (MPI_File_open(MPI_COMM_WORLD, profile.trace_path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file)
+        != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot create trace file %s\n", profile.trace_path);
+        return;
+    }
+    MPI_File_set_size(file, 0);
+
+    size_t capacity = 256 + profile.event_count * 160, length = 0;
+    char* text = malloc(capacity);
+    length += sprintf(text + length, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+                      "\"args\": {\"name\": \"rank %d\"}}", rank == 0 ? "[\n" : ",\n", rank, rank);
+    for (size_t i = 0; i < profile.event_count; i++) {
+        struct trace_event* e = &profile.events[i];
+        length += sprintf(text + length, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, "
+                          "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %lld}}",
+                          profile_names[e->part], rank, e->begin * 1e6, (e->end - e->begin) * 1e6, e->bytes);
+    }
+    if (rank == size - 1) length += sprintf(text + length, "\n]\n");
+    MPI_File_write_ordered(file, text, (int) length, MPI_CHAR, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    free(text);
+}
+
+void report_profile(void) {
+    int rank, size;
+    double least[PROFILE_PARTS], most[PROFILE_PARTS], sum[PROFILE_PARTS], mine[PROFILE_PARTS];
+    long long calls[PROFILE_PARTS], bytes[PROFILE_PARTS];
+    int callers[PROFILE_PARTS], called[PROFILE_PARTS];
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    // min and mean are over the ranks that ran a part at all, so parts
+    // only rank 0 runs do not show a min of 0
+    for (int i = 0; i < PROFILE_PARTS; i++) {
+        called[i] = profile.calls[i] > 0;
+        mine[i] = called[i] ? profile.time[i] : INFINITY;
+    }
+    MPI_Reduce(mine, least, PROFILE_PARTS, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(profile.time, most, PROFILE_PARTS, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(profile.time, sum, PROFILE_PARTS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(called, callers, PROFILE_PARTS, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(profile.calls, calls, PROFILE_PARTS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(profile.bytes, bytes, PROFILE_PARTS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stderr, "%-12s %10s %6s %12s %12s %12s %14s\n", "part", "calls", "ranks", "min s", "mean s", "max s",
+                "bytes");
+        for (int i = 0; i < PROFILE_PARTS; i++) {
+            if (calls[i] == 0) continue;
+            fprintf(stderr, "%-12s %10lld %6d %12.6f %12.6f %12.6f %14lld\n", profile_names[i], calls[i], callers[i],
+                    least[i], sum[i] / callers[i], most[i], bytes[i]);
+        }
+    }
+    if (profile.trace_path) write_trace();
+    free(profile.events);
+    profile.events = NULL;
+    profile.on = 0;
+}
+
+// 64 cells, each alive with probability digits / 256: every binary digit,
+// lowest first, ORs (1) or ANDs (0) in a fresh random word
+static uint64_t random_word(struct random_board* r, int digits, int row, int word) {
+    uint64_t key = mix64(r->seed), counter = ((uint64_t) row << 32 | (uint32_t) word) * 8, cells = 0;
+    if (digits >= 256) return ~(uint64_t) 0;
+    for (int k = 0; k < 8; k++) {
+        uint64_t bits = mix64(key + (counter + k) * 0x9e3779b97f4a7c15ULL);
+        cells = (digits >> k) & 1 ? cells | bits : cells & bits;
+    }
+    return cells;
+}
+
+static uint64_t random_last_mask(int columns) {
+    return columns % CELLS_PER_WORD ? ((uint64_t) 1 << (columns % CELLS_PER_WORD)) - 1 : ~(uint64_t) 0;
+}
+
+void fill_random(struct domain* d, struct random_board* r, uint64_t* local_board) {
+    int digits = (int) (r->density * 256 + 0.5);
+    uint64_t* block = owned_block(d, local_board);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < d->local_rows; i++) {
+        uint64_t* row = block + (size_t) i * d->pitch;
+        for (int j = 0; j < d->local_words; j++) row[j] = random_word(r, digits, d->row_start + i, d->word_start + j);
+        if (d->word_start + d->local_words == d->words) row[d->local_words - 1] &= random_last_mask(d->columns);
+    }
+}
+
+uint64_t* random_board(struct random_board* r) {
+    int digits = (int) (r->density * 256 + 0.5), words = words_per_row(r->columns);
+    uint64_t* board = malloc((size_t) r->rows * words * sizeof(uint64_t));
+    for (int i = 0; i < r->rows; i++) {
+        for (int j = 0; j < words; j++) board[(size_t) i * words + j] = random_word(r, digits, i, j);
+        board[(size_t) i * words + words - 1] &= random_last_mask(r->columns);
+    }
+    return board;
+}
+
+int read_board_list(const char* path, struct ensemble* e) {
+    FILE* list = fopen(path, "r");
+    char line[4096];
+    long long capacity = 0;
+    if (!list) return 0;
+    e->count = 0;
+    while (fgets(line, sizeof(line), list)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+        if (e->count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            e->paths = realloc(e->paths, capacity * sizeof(char*));
+        }
+        e->paths[e->count++] = strdup(line);
+    }
+    fclose(list);
+    return e->count > 0;
+}
+
+// a whole binary board read with stdio, which any thread may call; NULL
+// with *problem set if it is not a board
+static uint64_t* load_board(const char* path, int* rows, int* columns, const char** problem) {
+    struct board_header header;
+    FILE* file = fopen(path, "rb");
+    uint64_t* board = NULL;
+    if (!file) {
+        *problem = "cannot be opened";
+        return NULL;
+    }
+    memset(&header, 0, sizeof(header));
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if (fread(&header, sizeof(header), 1, file) != 1) *problem = "is not a binary board";
+    else *problem = board_problem(&header, size);
+    if (!*problem) {
+        size_t words = (size_t) header.rows * words_per_row(header.columns);
+        board = malloc(words * sizeof(uint64_t));
+        if (fread(board, sizeof(uint64_t), words, file) != words) {
+            *problem = "is truncated";
+            free(board);
+            board = NULL;
+        }
+        *rows = header.rows;
+        *columns = header.columns;
+    }
+    fclose(file);
+    return board;
+}
+
+// the live cells and the position-keyed hash of hash_region() over a
+// board whose rows start pitch words apart
+static long long board_population(uint64_t* board, int rows, int words, int pitch) {
+    long long population = 0;
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < words; j++) population += __builtin_popcountll(board[(size_t) i * pitch + j]);
+    return population;
+}
+
+static uint64_t board_hash(uint64_t* board, int rows, int words, int pitch) {
+    uint64_t h = 0;
+    for (int i = 0; i < rows; i++) {
+        uint64_t* row = board + (size_t) i * pitch;
+        for (int j = 0; j < words; j++)
+            if (row[j]) h += mix64(row[j] ^ (((uint64_t) i * words + j) * 0x9e3779b97f4a7c15ULL));
+    }
+    return h;
+}
+
+// run board i of the ensemble to the end and fill its ENSEMBLE_FIELDS
+// results; returns what is wrong with its board file, or NULL
+static const char* run_ensemble_board(struct ensemble* e, long long i, life_kernel kernel,
+                                      long long generations, int period, long long* result) {
+    int rows, columns, radius = rule.radius;
+    const char* problem = NULL;
+    uint64_t* board;
+    if (e->paths) {
+        board = load_board(e->paths[i], &rows, &columns, &problem);
+        if (!board) return problem;
+    }
+    else {
+        struct random_board r = e->random;
+        r.seed = e->first + i;
+        rows = r.rows;
+        columns = r.columns;
+        board = random_board(&r);
+    }
+
+    // the same layout as a single rank's local board: radius ghost rows
+    // and a guard word on either side, all left dead
+    int words = words_per_row(columns), pitch = words + GUARD_WORDS;
+    size_t size = (size_t) (rows + 2 * radius) * pitch;
+    uint64_t* old_board = calloc(size, sizeof(uint64_t));
+    uint64_t* new_board = calloc(size, sizeof(uint64_t));
+    uint64_t* history = malloc((period + 1) * sizeof(uint64_t));
+    struct region r = {radius, radius + rows, 1, 1 + words};
+    for (int row = 0; row < rows; row++)
+        memcpy(old_board + (size_t) (radius + row) * pitch + 1, board + (size_t) row * words, words * sizeof(uint64_t));
+    free(board);
+
+    long long stable = -1;
+    int cycle = 0;
+    uint64_t* block = old_board + (size_t) radius * pitch + 1;
+    result[0] = rows;
+    result[1] = columns;
+    result[2] = board_population(block, rows, words, pitch);
+    history[0] = board_hash(block, rows, words, pitch);
+    for (long long gen = 1; gen <= generations; gen++) {
+        kernel(new_board, old_board, pitch, r, words, random_last_mask(columns));
+        swapBrd(&new_board, &old_board);
+        if (cycle) continue;
+        block = old_board + (size_t) radius * pitch + 1;
+        uint64_t h = board_hash(block, rows, words, pitch);
+        for (int p = 1; p <= period && p <= gen; p++) {
+            if (history[(gen - p) % (period + 1)] == h) {
+                stable = gen - p;
+                cycle = p;
+                break;
+            }
+        }
+        history[gen % (period + 1)] = h;
+        // from here on only the phase of the cycle at the end matters
+        if (cycle) generations = gen + (generations - gen) % cycle;
+    }
+    result[3] = board_population(old_board + (size_t) radius * pitch + 1, rows, words, pitch);
+    result[4] = stable;
+    result[5] = cycle;
+    free(history);
+    free(old_board);
+    free(new_board);
+    return NULL;
+}
+
+void run_ensemble(struct ensemble* e, life_kernel kernel, long long generations, int period, int timing) {
+    int rank;
+    long long batch = (long long) ENSEMBLE_BATCH * omp_get_max_threads(), next, done = 0;
+    long long bad = -1;
+    const char* problem = NULL;
+    long long* counter;
+    long long* results = malloc((size_t) e->count * ENSEMBLE_FIELDS * sizeof(long long));
+    MPI_Win window;
+    double start = MPI_Wtime();
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    for (size_t i = 0; i < (size_t) e->count * ENSEMBLE_FIELDS; i++) results[i] = -1;
+    // the work queue is the index of the next board not yet taken
+    MPI_Win_allocate(rank == 0 ? sizeof(long long) : 0, sizeof(long long), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &counter, &window);
+    if (rank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+        *counter = 0;
+        MPI_Win_unlock(0, window);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(0, window);
+    for (;;) {
+        MPI_Fetch_and_op(&batch, &next, MPI_LONG_LONG, 0, 0, MPI_SUM, window);
+        MPI_Win_flush(0, window);
+        if (next >= e->count) break;
+        long long end = next + batch < e->count ? next + batch : e->count;
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (long long i = next; i < end; i++) {
+            const char* why = run_ensemble_board(e, i, kernel, generations, period, results + i * ENSEMBLE_FIELDS);
+            if (why) {
+                #pragma omp critical
+                if (bad < 0) {
+                    bad = i;
+                    problem = why;
+                }
+            }
+        }
+        if (bad >= 0) {
+            fprintf(stderr, "Board file %s %s\n", e->paths[bad], problem);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        done += end - next;
+    }
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+
+    // every result was filled in by exactly one rank, the rest are -1
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : results, results, e->count * ENSEMBLE_FIELDS, MPI_LONG_LONG,
+               MPI_MAX, 0, MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+    long long fewest = done, most = done;
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &fewest, &fewest, 1, MPI_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &most, &most, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("board,rows,columns,initial_population,final_population,stable_from,period\n");
+        for (long long i = 0; i < e->count; i++) {
+            long long* result = results + i * ENSEMBLE_FIELDS;
+            if (e->paths) printf("%s", e->paths[i]);
+            else printf("%lld", e->first + i);
+            printf(",%lld,%lld,%lld,%lld,%lld,%lld\n", result[0], result[1], result[2], result[3], result[4], result[5]);
+        }
+        fflush(stdout);
+        if (timing)
+            fprintf(stderr, "Ensemble of %lld boards in %f s (%.1f boards/s), %lld to %lld boards per rank\n",
+                    e->count, elapsed, e->count / elapsed, fewest, most);
+    }
+    free(results);
+}
+
+void report_timing(double* phase) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    double slowest[PHASES + 1];
+    // the exchange is whatever of the generations was not spent computing
+    memcpy(slowest, phase, sizeof(double) * PHASES);
+    slowest[PHASES] = phase[1] - phase[3];
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : slowest, slowest, PHASES + 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+        fprintf(stderr, "Input %.6f s, generations %.6f s (compute %.6f s, exchange %.6f s), output %.6f s\n",
+                slowest[0], slowest[1], slowest[3], slowest[4], slowest[2]);
+}
+
+uint64_t* read_board_file(MPI_File file, int rows, int columns) {
+    int words = words_per_row(columns);
+    uint64_t* board = malloc((size_t) rows * words * sizeof(uint64_t));
+    // a row at a time keeps every count well inside an int
+    for (int i = 0; i < rows; i++)
+        MPI_File_read_at(file, sizeof(struct board_header) + (MPI_Offset) i * words * sizeof(uint64_t),
+                         board + (size_t) i * words, words, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    return board;
+}
+
+void start_halo(struct domain* d, uint64_t* local_board, MPI_Request* requests) {
+    double t = profile_begin();
+    long long bytes = 0;
+    int n = 0;
+    if (d->shared) {
+        // local_board holds the generation this exchange is for
+        MPI_Win_sync(d->shared->window);
+        __atomic_store_n(&d->shared->base[0], ++d->shared->exchange, __ATOMIC_RELEASE);
+    }
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            if (dr == 0 && dc == 0) continue;
+            struct region recv = halo_zone(d, dr, dc, 0);
+            struct region send = halo_zone(d, dr, dc, 1);
+            int peer = d->nbr[dr + 1][dc + 1];
+            MPI_Datatype type = d->halo_type[dr + 1][dc + 1];
+            int count = 1;
+            if (d->shared && d->shared->on_node[dr + 1][dc + 1]) {
+                // finish_halo() copies these
+                requests[n++] = MPI_REQUEST_NULL;
+                requests[n++] = MPI_REQUEST_NULL;
+                continue;
+            }
+            if (halo_skippable(d, dc) && d->local_rows && !tiles_flagged(d->tiles, d->tiles->dirty, send))
+                count = 0;
+            // tags name the direction the data travels in
+            MPI_Irecv(local_board + recv.row_begin * d->pitch + recv.word_begin, 1, type, peer,
+                      (1 - dr) * 3 + (1 - dc), d->cart, &requests[n++]);
+            MPI_Isend(local_board + send.row_begin * d->pitch + send.word_begin, count, type, peer,
+                      (1 + dr) * 3 + (1 + dc), d->cart, &requests[n++]);
+            if (profile.on && peer != MPI_PROC_NULL && count) {
+                int type_size;
+                MPI_Type_size(type, &type_size);
+                bytes += type_size;
+            }
+        }
+    }
+    if (d->tiles) memset(d->tiles->dirty, 0, (size_t) d->tiles->rows * d->tiles->columns);
+    profile_end(PROFILE_HALO_START, t, bytes);
+}
+
+// wait until the counter at flag of every neighbour on the node has
+// reached this exchange
+static void wait_shared(struct shared* s, int flag) {
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            while (s->on_node[i][j] && __atomic_load_n(&s->peer[i][j][flag], __ATOMIC_ACQUIRE) < s->exchange)
+                sched_yield();
+    MPI_Win_sync(s->window);
+}
+
+// the on-node part of finish_halo(): copy the neighbours' edges into the
+// ghost zone (and, with active tiles, into other_board as well)
+static void shared_halo(struct domain* d, uint64_t* local_board, uint64_t* other_board) {
+    struct shared* s = d->shared;
+    // every rank swaps its boards in step, so the neighbours' current
+    // board is the one in the same place as mine
+    int current = local_board != s->base + SHARED_FLAG_WORDS;
+    wait_shared(s, 0);
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            if (!s->on_node[dr + 1][dc + 1]) continue;
+            struct region from = s->source[dr + 1][dc + 1], to = halo_zone(d, dr, dc, 0);
+            uint64_t* peer = s->peer[dr + 1][dc + 1] + SHARED_FLAG_WORDS + current * s->peer_board_words[dr + 1][dc + 1];
+            size_t bytes = (size_t) (to.word_end - to.word_begin) * sizeof(uint64_t);
+            for (int i = 0; i < to.row_end - to.row_begin; i++) {
+                uint64_t* row = local_board + (size_t) (to.row_begin + i) * d->pitch + to.word_begin;
+                memcpy(row, peer + (size_t) (from.row_begin + i) * s->peer_pitch[dr + 1][dc + 1] + from.word_begin, bytes);
+                if (d->tiles) memcpy(other_board + (row - local_board), row, bytes);
+            }
+            if (d->tiles && d->local_rows) flag_tiles(d->tiles, d->tiles->changed, to, 1);
+        }
+    }
+    MPI_Win_sync(s->window);
+    __atomic_store_n(&s->base[1], s->exchange, __ATOMIC_RELEASE);
+    // the board I just read from changes at the neighbours' next step, so
+    // hold on until they have all read mine
+    wait_shared(s, 1);
+}
+
+void setup_shared(struct domain* d, uint64_t** local_board, uint64_t** local_swap_board) {
+    struct shared* s = calloc(1, sizeof(struct shared));
+    MPI_Group cart_group, node_group;
+    MPI_Request requests[HALO_REQUESTS];
+    int shape[3][3][2], mine[2] = {d->local_rows, d->local_words}, n = 0;
+    size_t board_words = local_board_words(d);
+
+    MPI_Comm_split_type(d->cart, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &s->node);
+    MPI_Comm_group(d->cart, &cart_group);
+    MPI_Comm_group(s->node, &node_group);
+    MPI_Win_allocate_shared((SHARED_FLAG_WORDS + 2 * board_words) * sizeof(uint64_t), sizeof(uint64_t),
+                            MPI_INFO_NULL, s->node, &s->base, &s->window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, s->window);
+    memset(s->base, 0, SHARED_FLAG_WORDS * sizeof(uint64_t));
+    *local_board = s->base + SHARED_FLAG_WORDS;
+    *local_swap_board = *local_board + board_words;
+    // the same first touch as alloc_local_board()
+    int stored_rows = 2 * (d->local_rows + 2 * d->halo_rows);
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num(), nt = omp_get_num_threads();
+        int begin = split_start(stored_rows, nt, t);
+        memset(*local_board + (size_t) begin * d->pitch, 0,
+               (size_t) split_count(stored_rows, nt, t) * d->pitch * sizeof(uint64_t));
+    }
+
+    // the neighbours' block shapes say where their edges sit in their boards
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            if (dr == 0 && dc == 0) continue;
+            int peer = d->nbr[dr + 1][dc + 1];
+            MPI_Irecv(shape[dr + 1][dc + 1], 2, MPI_INT, peer, (1 - dr) * 3 + (1 - dc), d->cart, &requests[n++]);
+            MPI_Isend(mine, 2, MPI_INT, peer, (1 + dr) * 3 + (1 + dc), d->cart, &requests[n++]);
+        }
+    }
+    MPI_Waitall(n, requests, MPI_STATUSES_IGNORE);
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            int peer = d->nbr[dr + 1][dc + 1], node_rank = MPI_UNDEFINED;
+            if ((dr == 0 && dc == 0) || peer == MPI_PROC_NULL) continue;
+            MPI_Group_translate_ranks(cart_group, 1, &peer, node_group, &node_rank);
+            if (node_rank == MPI_UNDEFINED) continue;
+            struct domain other = *d;
+            MPI_Aint size;
+            int unit;
+            other.local_rows = shape[dr + 1][dc + 1][0];
+            other.local_words = shape[dr + 1][dc + 1][1];
+            other.pitch = other.local_words + 2 * d->halo_words;
+            s->on_node[dr + 1][dc + 1] = 1;
+            s->source[dr + 1][dc + 1] = halo_zone(&other, -dr, -dc, 1);
+            s->peer_pitch[dr + 1][dc + 1] = other.pitch;
+            s->peer_board_words[dr + 1][dc + 1] = local_board_words(&other);
+            MPI_Win_shared_query(s->window, node_rank, &size, &unit, &s->peer[dr + 1][dc + 1]);
+        }
+    }
+    MPI_Group_free(&cart_group);
+    MPI_Group_free(&node_group);
+    // no one looks at a neighbour's flags before they are zeroed
+    MPI_Win_sync(s->window);
+    MPI_Barrier(s->node);
+    d->shared = s;
+}
+
+void free_shared(struct domain* d) {
+    struct shared* s = d->shared;
+    MPI_Win_unlock_all(s->window);
+    MPI_Win_free(&s->window);
+    MPI_Comm_free(&s->node);
+    free(s);
+    d->shared = NULL;
+}
+
+void finish_halo(struct domain* d, uint64_t* local_board, uint64_t* other_board, MPI_Request* requests) {
+    MPI_Status statuses[HALO_REQUESTS];
+    int n = 0, count;
+    MPI_Waitall(HALO_REQUESTS, requests, statuses);
+    if (d->shared) shared_halo(d, local_board, other_board);
+    if (!d->tiles || d->local_rows == 0) return;
+
+    for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+            if (dr == 0 && dc == 0) continue;
+            MPI_Get_count(&statuses[n], d->halo_type[dr + 1][dc + 1], &count);
+            n += 2;
+            if (count == 0) continue;
+            // fresh ghost data: both boards have to agree on it for skipped
+            // tiles to stay valid, and the tiles it touches count as changed
+            struct region z = halo_zone(d, dr, dc, 0);
+            for (int i = z.row_begin; i < z.row_end; i++)
+                memcpy(other_board + i * d->pitch + z.word_begin, local_board + i * d->pitch + z.word_begin,
+                       (size_t) (z.word_end - z.word_begin) * sizeof(uint64_t));
+            flag_tiles(d->tiles, d->tiles->changed, z, 1);
+        }
+    }
+}
+
+void setup_tiles(struct domain* d) {
+    struct tiles* t = malloc(sizeof(struct tiles));
+    size_t n;
+    t->rows = (d->local_rows + 2 * d->halo_rows + TILE_ROWS - 1) / TILE_ROWS;
+    t->columns = (d->pitch + TILE_WORDS - 1) / TILE_WORDS;
+    n = (size_t) t->rows * t->columns;
+    t->changed = malloc(n);
+    t->next = calloc(n, 1);
+    t->dirty = malloc(n);
+    memset(t->changed, 1, n);
+    memset(t->dirty, 1, n);
+    d->tiles = t;
+}
+
+void free_tiles(struct domain* d) {
+    if (!d->tiles) return;
+    free(d->tiles->changed);
+    free(d->tiles->next);
+    free(d->tiles->dirty);
+    free(d->tiles);
+    d->tiles = NULL;
+}
+
+void end_generation(struct domain* d) {
+    struct tiles* t = d->tiles;
+    size_t n;
+    uint8_t* done;
+    if (!t) return;
+    n = (size_t) t->rows * t->columns;
+    for (size_t i = 0; i < n; i++) t->dirty[i] |= t->next[i];
+    done = t->changed;
+    t->changed = t->next;
+    t->next = done;
+    memset(t->next, 0, n);
+}
+
+// a tile has to be recomputed if it or a neighbouring tile changed
+static int tile_active(struct tiles* t, int tr, int tc) {
+    for (int i = tr > 0 ? tr - 1 : 0; i <= tr + 1 && i < t->rows; i++)
+        for (int j = tc > 0 ? tc - 1 : 0; j <= tc + 1 && j < t->columns; j++)
+            if (t->changed[i * t->columns + j]) return 1;
+    return 0;
+}
+
+static int region_differs(uint64_t* a, uint64_t* b, int pitch, struct region r) {
+    uint64_t diff = 0;
+    for (int i = r.row_begin; i < r.row_end; i++)
+        for (int j = r.word_begin; j < r.word_end; j++)
+            diff |= a[i * pitch + j] ^ b[i * pitch + j];
+    return diff != 0;
+}
+
+static void update_tiles(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board, struct region r) {
+    struct tiles* t = d->tiles;
+    int first_column = r.word_begin / TILE_WORDS, last_column = (r.word_end - 1) / TILE_WORDS;
+    #pragma omp parallel for schedule(static)
+    for (int tr = r.row_begin / TILE_ROWS; tr <= (r.row_end - 1) / TILE_ROWS; tr++) {
+        for (int tc = first_column; tc <= last_column; tc++) {
+            if (!tile_active(t, tr, tc)) continue;
+            struct region part = r;
+            if (part.row_begin < tr * TILE_ROWS) part.row_begin = tr * TILE_ROWS;
+            if (part.row_end > (tr + 1) * TILE_ROWS) part.row_end = (tr + 1) * TILE_ROWS;
+            if (part.word_begin < tc * TILE_WORDS) part.word_begin = tc * TILE_WORDS;
+            if (part.word_end > (tc + 1) * TILE_WORDS) part.word_end = (tc + 1) * TILE_WORDS;
+            kernel(new_board, old_board, d->pitch, part, d->last_word, d->last_mask);
+            if (region_differs(new_board, old_board, d->pitch, part)) t->next[tr * t->columns + tc] = 1;
+        }
+    }
+}
+
+struct region step_region(struct domain* d, int step) {
+    // ghost rows go stale from the outside in, radius rows per generation;
+    // the ghost word only loses cells at its far end, which the owned block
+    // never reaches while halo_rows <= 64. Nothing is computed past the
+    // edge of the board, where the ghost zone has to stay dead.
+    int extra_rows = (d->depth - step) * d->radius;
+    int extra_words = d->halo_words - 1;
+    struct region r;
+    r.row_begin = d->halo_rows - (d->nbr[0][1] != MPI_PROC_NULL ? extra_rows : 0);
+    r.row_end = d->halo_rows + d->local_rows + (d->nbr[2][1] != MPI_PROC_NULL ? extra_rows : 0);
+    r.word_begin = d->halo_words - (d->nbr[1][0] != MPI_PROC_NULL ? extra_words : 0);
+    r.word_end = d->halo_words + d->local_words + (d->nbr[1][2] != MPI_PROC_NULL ? extra_words : 0);
+    return r;
+}
+
+void update_region(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board, struct region r) {
+    int n = r.row_end - r.row_begin;
+    if (d->local_rows == 0 || n <= 0 || r.word_end <= r.word_begin) return;
+    if (d->tiles) {
+        update_tiles(d, kernel, new_board, old_board, r);
+        return;
+    }
+    // a static split, so every generation a thread updates about the rows
+    // it first touched in alloc_local_board()
+    #pragma omp parallel if (n > 1)
+    {
+        int t = omp_get_thread_num(), nt = omp_get_num_threads();
+        struct region part = r;
+        part.row_begin = r.row_begin + split_start(n, nt, t);
+        part.row_end = part.row_begin + split_count(n, nt, t);
+        if (part.row_end > part.row_begin)
+            kernel(new_board, old_board, d->pitch, part, d->last_word, d->last_mask);
+    }
+}
+
+// the owned block less its outermost radius rows and outermost words
+static struct region interior_region(struct domain* d) {
+    struct region r;
+    r.row_begin = d->halo_rows + d->radius;
+    r.row_end = d->halo_rows + d->local_rows - d->radius;
+    r.word_begin = d->halo_words + 1;
+    r.word_end = d->halo_words + d->local_words - 1;
+    if (r.row_end < r.row_begin) r.row_end = r.row_begin;
+    if (r.word_end < r.word_begin) r.word_end = r.word_begin;
+    return r;
+}
+
+void update_interior(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board) {
+    update_region(d, kernel, new_board, old_board, interior_region(d));
+}
+
+void update_boundary(struct domain* d, life_kernel kernel, uint64_t* new_board, uint64_t* old_board) {
+    struct region outer = step_region(d, 1);
+    struct region inner = interior_region(d);
+    struct region band;
+    // rows above and below the interior, full width
+    band = outer;
+    band.row_end = inner.row_begin;
+    update_region(d, kernel, new_board, old_board, band);
+    band = outer;
+    band.row_begin = inner.row_end;
+    update_region(d, kernel, new_board, old_board, band);
+    // words left and right of the interior
+    band = inner;
+    band.word_begin = outer.word_begin;
+    band.word_end = inner.word_begin;
+    update_region(d, kernel, new_board, old_board, band);
+    band = inner;
+    band.word_begin = inner.word_end;
+    band.word_end = outer.word_end;
+    update_region(d, kernel, new_board, old_board, band);
+}
+
+int tune_halo_depth(struct domain* d, life_kernel kernel) {
+    uint64_t* board = calloc(local_board_words(d), sizeof(uint64_t));
+    uint64_t* swap = calloc(local_board_words(d), sizeof(uint64_t));
+    MPI_Request halo[HALO_REQUESTS];
+    double timing[2], start;
+    int rank;
+
+    MPI_Barrier(d->cart);
+    start = MPI_Wtime();
+    for (int i = 0; i < TUNE_ROUNDS; i++) {
+        start_halo(d, board, halo);
+        MPI_Waitall(HALO_REQUESTS, halo, MPI_STATUSES_IGNORE);
+    }
+    timing[0] = (MPI_Wtime() - start) / TUNE_ROUNDS;
+    start = MPI_Wtime();
+    for (int i = 0; i < TUNE_ROUNDS; i++)
+        update_region(d, kernel, swap, board, step_region(d, 1));
+    // per row, since a depth of k recomputes (k - 1) * radius ghost rows a
+    // generation
+    timing[1] = (MPI_Wtime() - start) / TUNE_ROUNDS / (d->local_rows ? d->local_rows : 1) * d->radius;
+    MPI_Allreduce(MPI_IN_PLACE, timing, 2, MPI_DOUBLE, MPI_MAX, d->cart);
+    free(board);
+    free(swap);
+
+    // a generation costs exchange / k + (k - 1) * row, least at
+    // k = sqrt(exchange / row); the blocks must also hold k * radius rows
+    int min_rows = d->local_rows ? d->local_rows : INT_MAX;
+    MPI_Allreduce(MPI_IN_PLACE, &min_rows, 1, MPI_INT, MPI_MIN, d->cart);
+    int depth = timing[1] > 0 ? (int) (sqrt(timing[0] / timing[1]) + 0.5) : MAX_HALO_DEPTH;
+    if (depth > MAX_HALO_DEPTH / d->radius) depth = MAX_HALO_DEPTH / d->radius;
+    if (d->dims[0] > 1 && depth > min_rows / d->radius) depth = min_rows / d->radius;
+    if (depth < 1) depth = 1;
+
+    MPI_Comm_rank(d->cart, &rank);
+    if (rank == 0)
+        fprintf(stderr, "Halo depth %d (exchange %.3g s, %.3g s per row)\n", depth, timing[0], timing[1]);
+    return depth;
+}
+
+uint64_t* alloc_local_board(struct domain* d) {
+    int stored_rows = d->local_rows + 2 * d->halo_rows;
+    uint64_t* board = malloc(local_board_words(d) * sizeof(uint64_t));
+    #pragma omp parallel
+    {
+        int t = omp_get_thread_num(), nt = omp_get_num_threads();
+        int begin = split_start(stored_rows, nt, t);
+        memset(board + (size_t) begin * d->pitch, 0,
+               (size_t) split_count(stored_rows, nt, t) * d->pitch * sizeof(uint64_t));
+    }
+    return board;
+}
+
+void pin_threads(void) {
+#ifdef _OPENMP
+    cpu_set_t allowed;
+    if (omp_get_proc_bind() != omp_proc_bind_false || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+    #pragma omp parallel
+    {
+        // walk to the (thread % cores)-th core the rank may run on
+        int target = omp_get_thread_num() % CPU_COUNT(&allowed);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+                cpu_set_t mine;
+                CPU_ZERO(&mine);
+                CPU_SET(cpu, &mine);
+                sched_setaffinity(0, sizeof(mine), &mine);
+                break;
+            }
+        }
+    }
+#endif
+}
+
+void swapBrd(uint64_t **new_board, uint64_t **old_board){
+    uint64_t *temp = *new_board;
+    *new_board = *old_board;
+    *old_board = temp;
+}
+
+uint64_t* get_initial_board(int* rows, int* columns) {
+    uint64_t* board;
+    int i, words, value;
+    scanf("%d %d", rows, columns);
+    words = words_per_row(*columns);
+    board = calloc((size_t) (*rows) * words, sizeof(uint64_t));
+    for (i = 0; i < (*rows) * (*columns); i++) {
+        scanf("%d", &value);
+        if (value)
+            board[index1D(i / *columns, (i % *columns) / CELLS_PER_WORD, words)] |=
+                (uint64_t) 1 << ((i % *columns) % CELLS_PER_WORD);
+    }
+    return board;
+}
+
+void write_board(uint64_t* board, int rows, int columns) {
+    int words = words_per_row(columns);
+    // each row is formatted in one go, "%d\t" per cell, and written whole
+    char* line = malloc(2 * (size_t) columns + 1);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < columns; j++) {
+            line[2 * j] = '0' + (int) ((board[index1D(i, j / CELLS_PER_WORD, words)] >> (j % CELLS_PER_WORD)) & 1);
+            line[2 * j + 1] = '\t';
+        }
+        line[2 * columns] = '\n';
+        fwrite(line, 1, 2 * (size_t) columns + 1, stdout);
+    }
+    free(line);
+}
+
+// sum three bit vectors: sum gets the ones bit, carry the twos bit
+static inline void full_add(uint64_t a, uint64_t b, uint64_t c, uint64_t* sum, uint64_t* carry) {
+    uint64_t half = a ^ b;
+    *sum = half ^ c;
+    *carry = (a & b) | (half & c);
+}
+
+void generation(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                int last_word, uint64_t last_mask) {
+    for (int i = r.row_begin; i < r.row_end; i++) {
+        uint64_t* up = old_board + (i - 1) * pitch;
+        uint64_t* mid = old_board + i * pitch;
+        uint64_t* down = old_board + (i + 1) * pitch;
+        uint64_t* out = new_board + i * pitch;
+        for (int j = r.word_begin; j < r.word_end; j++) {
+            // neighbours to the left move up one bit, neighbours to the right
+            // move down one bit, borrowing the edge bit from the adjacent word
+            uint64_t up_l = (up[j] << 1) | (up[j - 1] >> 63);
+            uint64_t up_r = (up[j] >> 1) | (up[j + 1] << 63);
+            uint64_t mid_l = (mid[j] << 1) | (mid[j - 1] >> 63);
+            uint64_t mid_r = (mid[j] >> 1) | (mid[j + 1] << 63);
+            uint64_t down_l = (down[j] << 1) | (down[j - 1] >> 63);
+            uint64_t down_r = (down[j] >> 1) | (down[j + 1] << 63);
+
+            uint64_t up_ones, up_twos, down_ones, down_twos, ones, twos_a, twos_b, fours;
+            full_add(up_l, up[j], up_r, &up_ones, &up_twos);
+            full_add(down_l, down[j], down_r, &down_ones, &down_twos);
+            uint64_t mid_ones = mid_l ^ mid_r;
+            uint64_t mid_twos = mid_l & mid_r;
+            full_add(up_ones, mid_ones, down_ones, &ones, &twos_a);
+            full_add(up_twos, mid_twos, down_twos, &twos_b, &fours);
+            uint64_t twos = twos_a ^ twos_b;
+            fours |= twos_a & twos_b;
+
+            // alive next if neighbours == 3, or neighbours == 2 and alive now
+            out[j] = twos & ~fours & (ones | mid[j]);
+        }
+        if (last_word >= r.word_begin && last_word < r.word_end) out[last_word] &= last_mask;
+    }
+}
+
+// generation() for any radius 1 rule: the neighbours are counted into four
+// bit planes and each count in the rule is matched against them. Inlined
+// with constant masks the tests of counts outside the rule fold away.
+static inline __attribute__((always_inline))
+void generation_rule(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                     int last_word, uint64_t last_mask, uint32_t birth, uint32_t survive) {
+    for (int i = r.row_begin; i < r.row_end; i++) {
+        uint64_t* up = old_board + (i - 1) * pitch;
+        uint64_t* mid = old_board + i * pitch;
+        uint64_t* down = old_board + (i + 1) * pitch;
+        uint64_t* out = new_board + i * pitch;
+        for (int j = r.word_begin; j < r.word_end; j++) {
+            uint64_t up_l = (up[j] << 1) | (up[j - 1] >> 63);
+            uint64_t up_r = (up[j] >> 1) | (up[j + 1] << 63);
+            uint64_t mid_l = (mid[j] << 1) | (mid[j - 1] >> 63);
+            uint64_t mid_r = (mid[j] >> 1) | (mid[j + 1] << 63);
+            uint64_t down_l = (down[j] << 1) | (down[j - 1] >> 63);
+            uint64_t down_r = (down[j] >> 1) | (down[j + 1] << 63);
+
+            uint64_t up_ones, up_twos, down_ones, down_twos, ones, twos_a, twos_b, fours;
+            full_add(up_l, up[j], up_r, &up_ones, &up_twos);
+            full_add(down_l, down[j], down_r, &down_ones, &down_twos);
+            full_add(up_ones, mid_l ^ mid_r, down_ones, &ones, &twos_a);
+            full_add(up_twos, mid_l & mid_r, down_twos, &twos_b, &fours);
+            // unlike generation(), the count is kept exact up to 8
+            uint64_t twos = twos_a ^ twos_b;
+            uint64_t eights = fours & twos_a & twos_b;
+            fours ^= twos_a & twos_b;
+
+            uint64_t born = 0, kept = 0;
+            #pragma GCC unroll 9
+            for (int n = 0; n <= 8; n++) {
+                if (!(((birth | survive) >> n) & 1)) continue;
+                uint64_t match = (n & 1 ? ones : ~ones) & (n & 2 ? twos : ~twos)
+                               & (n & 4 ? fours : ~fours) & (n & 8 ? eights : ~eights);
+                if ((birth >> n) & 1) born |= match;
+                if ((survive >> n) & 1) kept |= match;
+            }
+            out[j] = (born & ~mid[j]) | (kept & mid[j]);
+        }
+        if (last_word >= r.word_begin && last_word < r.word_end) out[last_word] &= last_mask;
+    }
+}
+
+#define RULE_KERNEL(name, birth, survive) \
+    static void name(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r, \
+                     int last_word, uint64_t last_mask) { \
+        generation_rule(new_board, old_board, pitch, r, last_word, last_mask, birth, survive); \
+    }
+RULE_KERNEL(generation_highlife, 0x048, 0x00c)          // B36/S23
+RULE_KERNEL(generation_day_night, 0x1c8, 0x1d8)         // B3678/S34678
+RULE_KERNEL(generation_seeds, 0x004, 0x000)             // B2/S
+
+void generation_masks(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                      int last_word, uint64_t last_mask) {
+    generation_rule(new_board, old_board, pitch, r, last_word, last_mask, rule.birth, rule.survive);
+}
+
+life_kernel bitwise_kernel(struct rule* r) {
+    static const struct {
+        uint32_t birth, survive;
+        life_kernel kernel;
+    } compiled[] = {
+        {0x008, 0x00c, generation},
+        {0x048, 0x00c, generation_highlife},
+        {0x1c8, 0x1d8, generation_day_night},
+        {0x004, 0x000, generation_seeds},
+    };
+    for (size_t i = 0; i < sizeof(compiled) / sizeof(compiled[0]); i++)
+        if (compiled[i].birth == r->birth && compiled[i].survive == r->survive) return compiled[i].kernel;
+    return generation_masks;
+}
+
+// add (sign 1) or take away (sign -1) the cells of a packed row in stored
+// columns first .. first + width - 1 to the running column counts
+static void count_row(uint16_t* counts, uint64_t* row, int first, int width, int sign) {
+    for (int c = 0; c < width; c++) {
+        int cell = first + c;
+        counts[c] += sign * (int) ((row[cell / CELLS_PER_WORD] >> (cell % CELLS_PER_WORD)) & 1);
+    }
+}
+
+void generation_ltl(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                    int last_word, uint64_t last_mask) {
+    int radius = rule.radius, side = 2 * radius;
+    int first = r.word_begin * CELLS_PER_WORD - radius;
+    int width = (r.word_end - r.word_begin) * CELLS_PER_WORD + side;
+    const uint8_t* born = rule.next[0];
+    const uint8_t* kept = rule.next[1];
+    if (r.row_end <= r.row_begin || r.word_end <= r.word_begin) return;
+
+    // counts[c]: live cells of column first + c in the rows within radius
+    uint16_t* counts = calloc(width, sizeof(uint16_t));
+    for (int i = r.row_begin - radius; i < r.row_begin + radius; i++)
+        count_row(counts, old_board + i * pitch, first, width, 1);
+    for (int i = r.row_begin; i < r.row_end; i++) {
+        uint64_t* mid = old_board + i * pitch;
+        uint64_t* out = new_board + i * pitch;
+        count_row(counts, old_board + (i + radius) * pitch, first, width, 1);
+        // the square of cell x covers counts[x .. x + side]
+        int sum = 0;
+        for (int c = 0; c < side; c++) sum += counts[c];
+        for (int j = r.word_begin, x = 0; j < r.word_end; j++) {
+            uint64_t word = 0;
+            for (int k = 0; k < CELLS_PER_WORD; k++, x++) {
+                sum += counts[x + side];
+                int alive = (mid[j] >> k) & 1;
+                word |= (uint64_t) (alive ? kept : born)[sum - alive] << k;
+                sum -= counts[x];
+            }
+            out[j] = word;
+        }
+        if (last_word >= r.word_begin && last_word < r.word_end) out[last_word] &= last_mask;
+        count_row(counts, old_board + (i - radius) * pitch, first, width, -1);
+    }
+    free(counts);
+}
+
+int parse_rule(const char* text, int radius, struct rule* r) {
+    int most = (2 * radius + 1) * (2 * radius + 1) - 1, seen = 0;
+    char copy[256];
+    memset(r, 0, sizeof(*r));
+    r->text = text;
+    r->radius = radius;
+    if (radius < 1 || radius > MAX_RADIUS || strlen(text) >= sizeof(copy)) return 0;
+    strcpy(copy, text);
+    for (char* part = strtok(copy, "/"); part; part = strtok(NULL, "/")) {
+        int alive = part[0] == 'S' || part[0] == 's';
+        if ((!alive && part[0] != 'B' && part[0] != 'b') || (seen & (1 << alive))) return 0;
+        seen |= 1 << alive;
+        char* item = part + 1;
+        // digits alone at radius 1, a list of numbers and ranges otherwise
+        int digits = radius == 1 && strspn(item, "012345678") == strlen(item);
+        while (*item) {
+            char* end;
+            long low = digits ? *item - '0' : strtol(item, &end, 10), high = low;
+            if (digits) end = item + 1;
+            else if (end == item) return 0;
+            else if (*end == '-') {
+                item = end + 1;
+                high = strtol(item, &end, 10);
+                if (end == item) return 0;
+            }
+            if (low < 0 || high > most || low > high) return 0;
+            for (long n = low; n <= high; n++) r->next[alive][n] = 1;
+            if (*end == ',' && !digits) end++;
+            else if (*end && !digits) return 0;
+            item = end;
+        }
+    }
+    if (seen != 3) return 0;
+    for (int n = 0; n <= 8 && n <= most; n++) {
+        r->birth |= (uint32_t) r->next[0][n] << n;
+        r->survive |= (uint32_t) r->next[1][n] << n;
+        r->table |= (uint32_t) r->next[0][n] << n | (uint32_t) r->next[1][n] << (16 + n);
+    }
+    return 1;
+}
+
+// the eight bits of a byte spread to the low bits of eight bytes, byte k
+// of the result holding bit k, so a row unpacks a byte of cells at a time
+#define SPREAD(b) ((uint64_t) ((b) & 1) | (uint64_t) ((b) >> 1 & 1) << 8 | (uint64_t) ((b) >> 2 & 1) << 16 \
+                   | (uint64_t) ((b) >> 3 & 1) << 24 | (uint64_t) ((b) >> 4 & 1) << 32 \
+                   | (uint64_t) ((b) >> 5 & 1) << 40 | (uint64_t) ((b) >> 6 & 1) << 48 \
+                   | (uint64_t) ((b) >> 7 & 1) << 56)
+#define SPREAD4(b) SPREAD(b), SPREAD(b + 1), SPREAD(b + 2), SPREAD(b + 3)
+#define SPREAD16(b) SPREAD4(b), SPREAD4(b + 4), SPREAD4(b + 8), SPREAD4(b + 12)
+#define SPREAD64(b) SPREAD16(b), SPREAD16(b + 16), SPREAD16(b + 32), SPREAD16(b + 48)
+static const uint64_t spread_byte[256] = {SPREAD64(0), SPREAD64(64), SPREAD64(128), SPREAD64(192)};
+
+// the inverse: multiplying eight 0/1 bytes by this moves byte k to bit
+// 56 + k, with every partial product on a bit of its own, so no carries
+#define GATHER_BYTES 0x0102040810204080ULL
+
+// expand a packed row (starting at its left guard word) to one byte per cell
+static void unpack_row(uint8_t* cells, uint64_t* row, int words) {
+    for (int j = 0; j < words; j++) {
+        uint64_t word = row[1 + j];
+        for (int k = 0; k < 8; k++)
+            memcpy(cells + j * CELLS_PER_WORD + 8 * k, &spread_byte[(word >> 8 * k) & 0xFF], 8);
+    }
+}
+
+static void pack_row(uint64_t* row, uint8_t* cells, int words) {
+    for (int j = 0; j < words; j++) {
+        uint64_t word = 0, bytes;
+        for (int k = 0; k < 8; k++) {
+            memcpy(&bytes, cells + j * CELLS_PER_WORD + 8 * k, 8);
+            word |= (bytes * GATHER_BYTES >> 56) << 8 * k;
+        }
+        row[1 + j] = word;
+    }
+}
+
+// interior columns 1..columns-2: no bounds tests, next value from the table
+static void stencil_interior(uint8_t* restrict out, const uint8_t* restrict up,
+                             const uint8_t* restrict mid, const uint8_t* restrict down, int columns) {
+    uint32_t table = rule.table;
+    for (int j = 1; j < columns - 1; j++) {
+        unsigned neighbors = up[j - 1] + up[j] + up[j + 1]
+                           + mid[j - 1] + mid[j + 1]
+                           + down[j - 1] + down[j] + down[j + 1];
+        out[j] = (table >> ((unsigned) mid[j] << 4 | neighbors)) & 1;
+    }
+}
+
+void generation_stencil(uint64_t* new_board, uint64_t* old_board, int pitch, struct region r,
+                        int last_word, uint64_t last_mask) {
+    int span = r.word_end - r.word_begin;
+    int columns = span * CELLS_PER_WORD;
+    int first = (r.word_begin - 1) * CELLS_PER_WORD;  // column of cells[0], as count_neighbors() counts
+    if (r.row_end <= r.row_begin || span <= 0) return;
+
+    // pointers are offset so that unpack_row() and pack_row() see the
+    // window's first word where they expect the first owned word
+    uint64_t* old_rows = old_board + r.word_begin - 1;
+    uint64_t* new_rows = new_board + r.word_begin - 1;
+    uint8_t* cells = malloc((size_t) 4 * columns);
+    uint8_t* up = cells;
+    uint8_t* mid = cells + columns;
+    uint8_t* down = cells + 2 * columns;
+    uint8_t* out = cells + 3 * columns;
+
+    unpack_row(up, old_rows + (r.row_begin - 1) * pitch, span);
+    unpack_row(mid, old_rows + r.row_begin * pitch, span);
+    for (int i = r.row_begin; i < r.row_end; i++) {
+        unpack_row(down, old_rows + (i + 1) * pitch, span);
+        stencil_interior(out, up, mid, down, columns);
+        // edge loop: first and last column
+        out[0] = next_value(mid[0], count_neighbors(old_board, i, first, pitch));
+        out[columns - 1] = next_value(mid[columns - 1],
+            count_neighbors(old_board, i, first + columns - 1, pitch));
+        pack_row(new_rows + i * pitch, out, span);
+        if (last_word >= r.word_begin && last_word < r.word_end) new_board[i * pitch + last_word] &= last_mask;
+
+        uint8_t* recycled = up;
+        up = mid;
+        mid = down;
+        down = recycled;
+    }
+    free(cells);
+}
+
+int count_neighbors(uint64_t* board, int r, int c, int pitch) {
+    // Every owned cell has all eight neighbours in the local board: the
+    // ghost rows and guard words hold the cells of the neighbouring ranks,
+    // or zeros past the edge of the board.
+    int neighbors = 0;
+    assert(r > 0);
+
+    // Top left, top middle, top right
+    neighbors += get_cell(board + (r - 1) * pitch, c - 1);
+    neighbors += get_cell(board + (r - 1) * pitch, c);
+    neighbors += get_cell(board + (r - 1) * pitch, c + 1);
+    // Middle left, middle right
+    neighbors += get_cell(board + r * pitch, c - 1);
+    neighbors += get_cell(board + r * pitch, c + 1);
+    // Bottom left, bottom middle, bottom right
+    neighbors += get_cell(board + (r + 1) * pitch, c - 1);
+    neighbors += get_cell(board + (r + 1) * pitch, c);
+    neighbors += get_cell(board + (r + 1) * pitch, c + 1);
+
+    return neighbors;
+}
+
+
+int next_value(int cur_val, int neighbors) {
+   // Given a cell's current value (1 or 0) and its number of live
+   // neighbors (0-8), return its next value, looked up in the birth
+   // (dead) or survival (alive) half of the current rule's table
+   assert(cur_val == 0 || cur_val == 1);
+   assert(neighbors >= 0 && neighbors <= 8);
+
+   return (rule.table >> (cur_val << 4 | neighbors)) & 1;
+}
+
+// HashLife. Cells outside the board never come alive, so they are stored
+// as a third state, wall, which counts as dead and never changes. That
+// keeps the rule translation invariant: every node is a pure function of
+// its cells and can be shared and memoized wherever it occurs.
+#define HL_DEAD 0
+#define HL_ALIVE 1
+#define HL_WALL 2
+#define HL_CELLS 3                      // node indices below this are cells
+#define HL_MAX_LEVEL 64
+#define HL_NONE UINT32_MAX
+
+struct hl_node {
+    uint32_t child[4];                  // nw, ne, sw, se
+    uint32_t result;                    // memoized successor, or HL_NONE
+    uint32_t next;                      // hash chain
+    uint8_t level;                      // 2^level cells on a side
+    uint8_t live;                       // any live cell below
+};
+
+static struct {
+    struct hl_node* nodes;
+    uint32_t* forward;                  // scratch for compaction
+    uint32_t* buckets;
+    uint32_t count, capacity, mask;
+    uint32_t wall[HL_MAX_LEVEL + 1];    // all-wall node of each level
+    int step;                           // results advance 2^min(level - 2, step)
+    int full;                           // ran out of nodes in this step
+} hl;
+
+static uint32_t hl_hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint64_t h = a * 0x9E3779B97F4A7C15ull;
+    h = (h ^ b) * 0xC2B2AE3D27D4EB4Full;
+    h = (h ^ c) * 0x165667B19E3779F9ull;
+    h = (h ^ d) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t) (h >> 32);
+}
+
+static int hl_level(uint32_t n) { return n < HL_CELLS ? 0 : hl.nodes[n].level; }
+static int hl_live(uint32_t n) { return n < HL_CELLS ? n == HL_ALIVE : hl.nodes[n].live; }
+
+// the unique node with these four quadrants; once the pool is full it
+// hands back a wall node so the step can unwind, and flags the step
+static uint32_t hl_join(uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se) {
+    uint32_t h = hl_hash(nw, ne, sw, se) & hl.mask;
+    int level = hl_level(nw) + 1;
+    for (uint32_t n = hl.buckets[h]; n != HL_NONE; n = hl.nodes[n].next) {
+        struct hl_node* p = &hl.nodes[n];
+        if (p->child[0] == nw && p->child[1] == ne && p->child[2] == sw && p->child[3] == se) return n;
+    }
+    if (hl.count == hl.capacity) {
+        hl.full = 1;
+        return hl.wall[level];
+    }
+    uint32_t n = hl.count++;
+    struct hl_node* p = &hl.nodes[n];
+    p->child[0] = nw;
+    p->child[1] = ne;
+    p->child[2] = sw;
+    p->child[3] = se;
+    p->result = HL_NONE;
+    p->level = level;
+    p->live = hl_live(nw) | hl_live(ne) | hl_live(sw) | hl_live(se);
+    p->next = hl.buckets[h];
+    hl.buckets[h] = n;
+    return n;
+}
+
+static uint32_t hl_child(uint32_t n, int i) { return hl.nodes[n].child[i]; }
+
+// the level - 1 node centred in n
+static uint32_t hl_centre(uint32_t n) {
+    return hl_join(hl_child(hl_child(n, 0), 3), hl_child(hl_child(n, 1), 2),
+                   hl_child(hl_child(n, 2), 1), hl_child(hl_child(n, 3), 0));
+}
+
+// one generation of the centre 2x2 of a level 2 node
+static uint32_t hl_base(uint32_t n) {
+    int cell[4][4];
+    uint32_t out[4];
+    for (int q = 0; q < 4; q++)
+        for (int i = 0; i < 4; i++)
+            cell[(q / 2) * 2 + i / 2][(q % 2) * 2 + i % 2] = hl_child(hl_child(n, q), i);
+    for (int i = 0; i < 4; i++) {
+        int r = 1 + i / 2, c = 1 + i % 2, neighbors = 0;
+        for (int dr = -1; dr <= 1; dr++)
+            for (int dc = -1; dc <= 1; dc++)
+                if (dr || dc) neighbors += cell[r + dr][c + dc] == HL_ALIVE;
+        if (cell[r][c] == HL_WALL) out[i] = HL_WALL;
+        else out[i] = (rule.table >> (cell[r][c] * 16 + neighbors)) & 1;
+    }
+    return hl_join(out[0], out[1], out[2], out[3]);
+}
+
+// the centre of n, 2^min(level - 2, hl.step) generations on
+static uint32_t hl_successor(uint32_t n) {
+    struct hl_node* p = &hl.nodes[n];
+    int level = p->level;
+    uint32_t result, sub[3][3], quad[4];
+    if (p->result != HL_NONE) return p->result;
+    if (hl.full) return hl.wall[level - 1];
+    if (level == 2) {
+        result = hl_base(n);
+        if (!hl.full) hl.nodes[n].result = result;
+        return result;
+    }
+
+    // nine overlapping level - 1 nodes covering the centre of n
+    uint32_t nw = p->child[0], ne = p->child[1], sw = p->child[2], se = p->child[3];
+    sub[0][0] = nw;
+    sub[0][1] = hl_join(hl_child(nw, 1), hl_child(ne, 0), hl_child(nw, 3), hl_child(ne, 2));
+    sub[0][2] = ne;
+    sub[1][0] = hl_join(hl_child(nw, 2), hl_child(nw, 3), hl_child(sw, 0), hl_child(sw, 1));
+    sub[1][1] = hl_join(hl_child(nw, 3), hl_child(ne, 2), hl_child(sw, 1), hl_child(se, 0));
+    sub[1][2] = hl_join(hl_child(ne, 2), hl_child(ne, 3), hl_child(se, 0), hl_child(se, 1));
+    sub[2][0] = sw;
+    sub[2][1] = hl_join(hl_child(sw, 1), hl_child(se, 0), hl_child(sw, 3), hl_child(se, 2));
+    sub[2][2] = se;
+
+    // full speed takes two half-steps through the sub nodes; slower steps
+    // only move their centres and leave all the time to the second round
+    int full_speed = level - 2 <= hl.step;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            sub[i][j] = full_speed ? hl_successor(sub[i][j]) : hl_centre(sub[i][j]);
+    for (int q = 0; q < 4; q++) {
+        int i = q / 2, j = q % 2;
+        quad[q] = hl_successor(hl_join(sub[i][j], sub[i][j + 1], sub[i + 1][j], sub[i + 1][j + 1]));
+    }
+    result = hl_join(quad[0], quad[1], quad[2], quad[3]);
+    if (!hl.full) hl.nodes[n].result = result;
+    return result;
+}
+
+// Eviction: drop every memoized result and every node not reachable from
+// root, compacting the pool in place. Children always sit below their
+// parents, so one pass down marks and one pass up moves.
+static uint32_t hl_collect(uint32_t root) {
+    memset(hl.forward, 0, (size_t) hl.count * sizeof(uint32_t));
+    hl.forward[root] = 1;
+    for (int l = 1; l <= HL_MAX_LEVEL; l++) hl.forward[hl.wall[l]] = 1;
+    for (uint32_t n = hl.count; n-- > HL_CELLS; )
+        if (hl.forward[n])
+            for (int i = 0; i < 4; i++) hl.forward[hl.nodes[n].child[i]] = 1;
+
+    uint32_t kept = HL_CELLS;
+    for (uint32_t n = 0; n < HL_CELLS; n++) hl.forward[n] = n;
+    memset(hl.buckets, 0xff, ((size_t) hl.mask + 1) * sizeof(uint32_t));
+    for (uint32_t n = HL_CELLS; n < hl.count; n++) {
+        if (!hl.forward[n]) continue;
+        struct hl_node p = hl.nodes[n];
+        for (int i = 0; i < 4; i++) p.child[i] = hl.forward[p.child[i]];
+        p.result = HL_NONE;
+        uint32_t h = hl_hash(p.child[0], p.child[1], p.child[2], p.child[3]) & hl.mask;
+        p.next = hl.buckets[h];
+        hl.buckets[h] = kept;
+        hl.nodes[kept] = p;
+        hl.forward[n] = kept++;
+    }
+    hl.count = kept;
+    for (int l = 1; l <= HL_MAX_LEVEL; l++) hl.wall[l] = hl.forward[hl.wall[l]];
+    return hl.forward[root];
+}
+
+static void hl_set_step(int step) {
+    if (hl.step == step) return;
+    hl.step = step;
+    for (uint32_t n = HL_CELLS; n < hl.count; n++) hl.nodes[n].result = HL_NONE;
+}
+
+// the level-th node over board cells [r0, r0 + 2^level) x [c0, ...)
+static uint32_t hl_build(uint64_t* board, int rows, int columns, int level, long r0, long c0) {
+    if (r0 >= rows || c0 >= columns) return hl.wall[level];
+    if (level == 0) {
+        uint64_t word = board[r0 * words_per_row(columns) + c0 / CELLS_PER_WORD];
+        return (word >> (c0 % CELLS_PER_WORD)) & 1;
+    }
+    long half = 1L << (level - 1);
+    return hl_join(hl_build(board, rows, columns, level - 1, r0, c0),
+                   hl_build(board, rows, columns, level - 1, r0, c0 + half),
+                   hl_build(board, rows, columns, level - 1, r0 + half, c0),
+                   hl_build(board, rows, columns, level - 1, r0 + half, c0 + half));
+}
+
+static void hl_write(uint32_t n, uint64_t* board, int rows, int columns, long r0, long c0) {
+    if (!hl_live(n) || r0 >= rows || c0 >= columns) return;
+    if (n < HL_CELLS) {
+        board[r0 * words_per_row(columns) + c0 / CELLS_PER_WORD] |= (uint64_t) 1 << (c0 % CELLS_PER_WORD);
+        return;
+    }
+    long half = 1L << (hl.nodes[n].level - 1);
+    for (int i = 0; i < 4; i++)
+        hl_write(hl.nodes[n].child[i], board, rows, columns, r0 + (i / 2) * half, c0 + (i % 2) * half);
+}
+
+// root (board at its top-left corner) padded with wall to one level up,
+// whose successor covers exactly root's square
+static uint32_t hl_padded(uint32_t root) {
+    uint32_t w = hl.wall[hl.nodes[root].level - 1];
+    return hl_join(hl_join(w, w, w, hl_child(root, 0)), hl_join(w, w, hl_child(root, 1), w),
+                   hl_join(w, hl_child(root, 2), w, w), hl_join(hl_child(root, 3), w, w, w));
+}
+
+static uint32_t hl_try(uint32_t root, int step) {
+    uint32_t next;
+    hl_set_step(step);
+    hl.full = 0;
+    next = hl_successor(hl_padded(root));
+    return hl.full ? HL_NONE : next;
+}
+
+// advance root by 2^step generations, or return HL_NONE if even a single
+// generation does not fit in the pool
+static uint32_t hl_advance(uint32_t root, int step) {
+    uint32_t next = hl_try(root, step);
+    if (next != HL_NONE) return next;
+
+    // out of nodes: evict everything but root and retry, then fall back
+    // to two half jumps, which need fewer nodes at once
+    root = hl_collect(root);
+    next = hl_try(root, step);
+    if (next != HL_NONE || step == 0) return next;
+    root = hl_advance(hl_collect(root), step - 1);
+    return root == HL_NONE ? HL_NONE : hl_advance(root, step - 1);
+}
+
+int run_hashlife(uint64_t* board, int rows, int columns, long long generations, size_t memory) {
+    // the node pool, its compaction scratch and up to one bucket per node
+    // all come out of memory
+    size_t per_node = sizeof(struct hl_node) + 2 * sizeof(uint32_t);
+    size_t buckets = 1;
+    int level = 2;
+    uint32_t root;
+
+    hl.capacity = memory / per_node < HL_NONE - 1 ? (uint32_t) (memory / per_node) : HL_NONE - 1;
+    while (buckets * 2 <= hl.capacity) buckets *= 2;
+    hl.mask = buckets - 1;
+    hl.nodes = malloc((size_t) hl.capacity * sizeof(struct hl_node));
+    hl.forward = malloc((size_t) hl.capacity * sizeof(uint32_t));
+    hl.buckets = malloc(buckets * sizeof(uint32_t));
+    if (!hl.nodes || !hl.forward || !hl.buckets || hl.capacity < HL_CELLS + 2 * HL_MAX_LEVEL) {
+        fprintf(stderr, "HashLife memory cap of %zu bytes is too small\n", memory);
+        return -1;
+    }
+    memset(hl.buckets, 0xff, buckets * sizeof(uint32_t));
+    hl.count = HL_CELLS;
+    hl.step = -1;
+    hl.full = 0;
+    hl.wall[0] = HL_WALL;
+    for (int l = 1; l <= HL_MAX_LEVEL; l++) {
+        uint32_t w = hl.wall[l - 1];
+        hl.wall[l] = hl_join(w, w, w, w);
+    }
+
+    while ((1L << level) < rows || (1L << level) < columns) level++;
+    root = hl_build(board, rows, columns, level, 0, 0);
+
+    // jump by each power of two in generations; the padded root must be at
+    // least two levels above the jump
+    for (int step = 0; generations >> step && root != HL_NONE && !hl.full; step++) {
+        if (!((generations >> step) & 1)) continue;
+        while (hl.nodes[root].level < step + 1 && !hl.full) {
+            uint32_t w = hl.wall[hl.nodes[root].level];
+            root = hl_join(root, w, w, w);
+        }
+        root = hl_advance(root, step);
+    }
+    if (root == HL_NONE || hl.full) {
+        fprintf(stderr, "HashLife memory cap of %zu bytes is too small for this board\n", memory);
+        free(hl.nodes);
+        free(hl.forward);
+        free(hl.buckets);
+        return -1;
+    }
+
+    memset(board, 0, (size_t) rows * words_per_row(columns) * sizeof(uint64_t));
+    hl_write(root, board, rows, columns, 0, 0);
+    free(hl.nodes);
+    free(hl.forward);
+    free(hl.buckets);
+    return 0;
+}
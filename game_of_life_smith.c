@@ -5,34 +5,39 @@
 
 #include<stdio.h>
 #include<stdlib.h>
-#include<assert.h>
+#include<string.h>
+#include<stdint.h>
 #include<mpi.h>
 
 #define NEIGHBOR_OFFSET 2
 
+// Boards are bit-packed, 64 cells per word: cell [r][c] is bit c%64 of
+// word c/64 in row r. Local rows get a zero guard word on each end.
+#define CELLS_PER_WORD 64
+#define GUARD_WORDS 2
+
 // Read initial board from stdin or file (via redirect) and return pointer to it
 // File format will be:
 // #rows #columns
 // Followed by each row in the format: 001110100
 // Board will be rectangular, but not necessarily square
-// Returns the board (as a 1D array laid out in row-major order),
-//   and populates the rows and columns variables
-int* get_initial_board(int* rows, int* columns);
-void write_board(int* board, int rows, int columns); // write board to stdout
-
-// simulate 1 generation
-void generation(int* new_board, int* old_board, int rows, int columns);
+// Returns the board (packed, words_per_row(columns) words per row, laid out
+//   in row-major order), and populates the rows and columns variables
+uint64_t* get_initial_board(int* rows, int* columns);
+void write_board(uint64_t* board, int rows, int columns); // write board to stdout
 
-// return # neighbors of cell [row][column]
-int count_neighbors(int* board, int r, int c, int rows, int columns);
-
-// given # of neighbors and current value, return next value
-int next_value(int cur_val, int neighbors);
+// simulate 1 generation of rows [row_begin, row_end) with bitwise full
+// adders, 64 cells per word (local row 0 and the row after the last local
+// row are ghost rows)
+void generation(uint64_t* new_board, uint64_t* old_board, int row_begin, int row_end, int words, uint64_t last_mask);
 
 // helper function to convert 2D to 1D index
 int index1D(int r, int c, int columns) { return r * columns + c; }
 
-void runGameOfLife(int mpi_rank, int mpi_size, int* initialboard, int maxgen, int rows, int cols);
+// number of packed words needed for a row of columns cells
+int words_per_row(int columns) { return (columns + CELLS_PER_WORD - 1) / CELLS_PER_WORD; }
+
+void runGameOfLife(int mpi_rank, int mpi_size, uint64_t* initialboard, int maxgen, int rows, int cols);
 
 int main(int argc, char** argv) {
     // MPI Init:
@@ -46,7 +51,7 @@ int main(int argc, char** argv) {
     int rows;
     int cols;
     int maxgen;
-    int* initialboard = NULL;
+    uint64_t* initialboard = NULL;
     if (mpi_rank == 0) {
         if (argc < 2) {
             printf("Usage: ./life.x generations\n");
@@ -60,9 +65,13 @@ int main(int argc, char** argv) {
     MPI_Barrier(MPI_COMM_WORLD);
     
     runGameOfLife(mpi_rank, mpi_size, initialboard, maxgen, rows, cols);
+    
+    free(initialboard);
+    MPI_Finalize();
+    return 0;
 }
 
-void runGameOfLife(int mpi_rank, int mpi_size, int* initialboard, int maxgen, int rows, int cols) {
+void runGameOfLife(int mpi_rank, int mpi_size, uint64_t* initialboard, int maxgen, int rows, int cols) {
     // Initialization Code
     // Broadcast rows and cols to every rank
     MPI_Bcast(&rows, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -72,8 +81,14 @@ void runGameOfLife(int mpi_rank, int mpi_size, int* initialboard, int maxgen, in
         //printf("rows = %d, cols = %d, maxgen = %d\n", rows, cols, maxgen);
     }
     
+    // Packed words per row, plus a zero guard word at each end of local rows
+    int words = words_per_row(cols);
+    int pitch = words + GUARD_WORDS;
+    uint64_t lastMask = (cols % CELLS_PER_WORD) ? (((uint64_t) 1 << (cols % CELLS_PER_WORD)) - 1) : ~(uint64_t) 0;
+    
     // Get # of rows per process
-    int numRowsPerThread = rows/mpi_size;
+    int baseRowsPerThread = rows/mpi_size;
+    int numRowsPerThread = baseRowsPerThread;
     
     // Create local 2D array for given number of rows
     int remainderRows = rows % mpi_size;
@@ -81,130 +96,92 @@ void runGameOfLife(int mpi_rank, int mpi_size, int* initialboard, int maxgen, in
     if (mpi_rank == mpi_size-1) {
         numRowsPerThread += remainderRows;
     }
-    int* localNewBoard = malloc(sizeof(int) * (numRowsPerThread+NEIGHBOR_OFFSET) * cols);
-    int* localOldBoard = malloc(sizeof(int) * (numRowsPerThread+NEIGHBOR_OFFSET) * cols);
-    
-    // Zero out game board
-    for (int i=0; i<numRowsPerThread+NEIGHBOR_OFFSET; i++) {
-        for (int j=0; j<cols; j++) {
-            localNewBoard[index1D(i, j, cols)] = 0;
-            localOldBoard[index1D(i, j, cols)] = 0;
-        }
-    }
+    // calloc zeroes out game board, including ghost rows and guard words
+    uint64_t* localNewBoard = calloc((size_t) (numRowsPerThread+NEIGHBOR_OFFSET) * pitch, sizeof(uint64_t));
+    uint64_t* localOldBoard = calloc((size_t) (numRowsPerThread+NEIGHBOR_OFFSET) * pitch, sizeof(uint64_t));
     
-    // Initialize the neighbor row numbers and pointers
-    // Pointer to the up neighbor's row start
+    // Initialize the neighbor row numbers
+    // Local row 0 holds the up neighbor's last row, local row
+    // numRowsPerThread+1 the down neighbor's first row
     int rowUpRank = mpi_rank-1;
-    int* rowUp = localNewBoard;
+    if (rowUpRank < 0) rowUpRank = MPI_PROC_NULL;
+    int rowDownRank = mpi_rank+1;
+    if (rowDownRank >= mpi_size) rowDownRank = MPI_PROC_NULL;
     
     // Starting offset for local rows
-    int* localRows = localNewBoard + cols;
-    int* localOldRows = localOldBoard + cols;
+    uint64_t* localRows = localNewBoard + pitch;
     
-    // Last row for local rows
-    int* localLastRow = localNewBoard + (numRowsPerThread * cols);
-    
-    // Pointer to the down neighbors row start
-    int rowDownRank = mpi_rank+1;
-    int* rowDown = localNewBoard + ((numRowsPerThread+1) * cols);
+    // Packed rows travel without their guard words
+    MPI_Datatype baseRowsType, remainderRowsType;
+    MPI_Type_vector(baseRowsPerThread, words, pitch, MPI_UINT64_T, &baseRowsType);
+    MPI_Type_commit(&baseRowsType);
+    MPI_Type_vector(remainderRows, words, pitch, MPI_UINT64_T, &remainderRowsType);
+    MPI_Type_commit(&remainderRowsType);
     
     // Send each process its chunk of the array
-    MPI_Scatter(initialboard, numRowsPerThread * cols, MPI_INT, localRows, numRowsPerThread * cols, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Scatter(initialboard, baseRowsPerThread * words, MPI_UINT64_T, localRows + 1, 1, baseRowsType, 0, MPI_COMM_WORLD);
 
     // Send rank-1 it's final chunks if any
     if ((remainderRows != 0) && (mpi_rank == 0)) {
-        int* finalRows = initialboard + (mpi_size * numRowsPerThread * cols) + cols;
+        uint64_t* finalRows = initialboard + (mpi_size * baseRowsPerThread * words);
         //printf("R%d->R%d Sending remainder chunk\n", mpi_rank, mpi_size-1);
-        MPI_Send(finalRows, remainderRows*cols, MPI_INT, mpi_size-1, 2, MPI_COMM_WORLD);
+        MPI_Send(finalRows, remainderRows*words, MPI_UINT64_T, mpi_size-1, 2, MPI_COMM_WORLD);
     }
     else if ((remainderRows != 0) && (mpi_rank == mpi_size-1)) {
-        int* finalRows = localNewBoard + (numRowsPerThread+1 * cols);
+        uint64_t* finalRows = localNewBoard + ((baseRowsPerThread+1) * pitch) + 1;
         //printf("R%d<-R%d Receiving remainder chunk\n", mpi_rank, 0);
-        MPI_Recv(finalRows, remainderRows*cols, MPI_INT, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        MPI_Recv(finalRows, 1, remainderRowsType, 0, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     }
     
     // Init Generation
     int currgen = 1;
     
-    // MPI_Barrier
-    MPI_Barrier(MPI_COMM_WORLD);
-    
-    // Run each iteration in lockstep based on current generation #
+    // Run each iteration in lockstep based on current generation #; the
+    // halo messages pace the ranks, so no barriers are needed
     while (currgen <= maxgen) {
-        MPI_Barrier(MPI_COMM_WORLD);
-        
-        // Store localNewBoard into previous board
-        // Todo just swap pointers...
-        for (unsigned int i=0; i<numRowsPerThread+NEIGHBOR_OFFSET; i++) {
-            for (unsigned int j=0; j<cols; j++) {
-                localOldBoard[index1D(i, j, cols)] = localNewBoard[index1D(i, j, cols)];
-            }
-        }
-        
-        // MPI_Barrier
-        MPI_Barrier(MPI_COMM_WORLD);
+        // The last generation's result becomes the board we read from
+        uint64_t* swap = localOldBoard;
+        localOldBoard = localNewBoard;
+        localNewBoard = swap;
         
         // Neighbor Synchronization Point
-        // Send to +-1 ranks this previous board
-        // Recv from +- ranks for their previous board
-        if (mpi_rank == 0) {
-            // Send last row to rank+1
-            MPI_Send(localLastRow, cols, MPI_INT, mpi_rank+1, 0, MPI_COMM_WORLD);
-            
-            // Receive first row from rank+1
-            MPI_Recv(rowDown, cols, MPI_INT, mpi_rank+1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
-        else if (mpi_rank == mpi_size-1) {
-            // Send first row to rank-1
-            MPI_Send(localLastRow, cols, MPI_INT, mpi_rank-1, 0, MPI_COMM_WORLD);
-            
-            // Receive last row from rank-1
-            MPI_Recv(rowUp, cols, MPI_INT, mpi_rank-1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
-        else {
-            // Send first row to rank-1
-            MPI_Send(localLastRow, cols, MPI_INT, mpi_rank-1, 0, MPI_COMM_WORLD);
-            
-            // Receive last row from rank-1
-            MPI_Recv(rowUp, cols, MPI_INT, mpi_rank-1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            
-            // Send last row to rank+1
-            MPI_Send(localLastRow, cols, MPI_INT, mpi_rank+1, 0, MPI_COMM_WORLD);
-            
-            // Receive first row from rank+1
-            MPI_Recv(rowDown, cols, MPI_INT, mpi_rank+1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        }
+        // Post receives for the ghost rows, send first row to rank-1 and
+        // last row to rank+1 without waiting for them
+        MPI_Request requests[4];
+        MPI_Irecv(localOldBoard, pitch, MPI_UINT64_T, rowUpRank, 0, MPI_COMM_WORLD, &requests[0]);
+        MPI_Irecv(localOldBoard + ((numRowsPerThread+1) * pitch), pitch, MPI_UINT64_T, rowDownRank, 1, MPI_COMM_WORLD, &requests[1]);
+        MPI_Isend(localOldBoard + pitch, pitch, MPI_UINT64_T, rowUpRank, 1, MPI_COMM_WORLD, &requests[2]);
+        MPI_Isend(localOldBoard + (numRowsPerThread * pitch), pitch, MPI_UINT64_T, rowDownRank, 0, MPI_COMM_WORLD, &requests[3]);
         
-        // Probably not needed...
-        MPI_Barrier(MPI_COMM_WORLD);
+        // Generate the rows that don't need the ghost rows while the
+        // messages are in flight
+        generation(localNewBoard, localOldBoard, 2, numRowsPerThread, words, lastMask);
         
-        // Generate new rows in localNewBoard
-        if (mpi_rank == 0) {
-            generation(localRows, localOldRows, numRowsPerThread+NEIGHBOR_OFFSET-1, cols);
-        }
-        else if (mpi_rank == mpi_size-1) {
-            generation(localNewBoard, localOldBoard, numRowsPerThread+NEIGHBOR_OFFSET-1, cols);
-        }
-        else {
-            generation(localNewBoard, localOldBoard, numRowsPerThread+NEIGHBOR_OFFSET, cols);
+        MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+        
+        // Then the first and last row
+        generation(localNewBoard, localOldBoard, 1, numRowsPerThread < 2 ? numRowsPerThread+1 : 2, words, lastMask);
+        if (numRowsPerThread >= 2) {
+            generation(localNewBoard, localOldBoard, numRowsPerThread, numRowsPerThread+1, words, lastMask);
         }
         
         // Increment current generation and rerun
         currgen++;
     }
+    localRows = localNewBoard + pitch;
 
     // Gather all rows from processes and consolidate
-    MPI_Gather(localRows, numRowsPerThread*cols, MPI_INT, initialboard, numRowsPerThread*cols, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gather(localRows + 1, 1, baseRowsType, initialboard, baseRowsPerThread*words, MPI_UINT64_T, 0, MPI_COMM_WORLD);
     
     
     // Gather remaining from mpi_size-1
     if ((remainderRows != 0) && (mpi_rank == 0)) {
-        int* finalRows = initialboard + (mpi_size * numRowsPerThread * cols) + cols;
-        MPI_Recv(finalRows, remainderRows*cols, MPI_INT, mpi_size-1, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        uint64_t* finalRows = initialboard + (mpi_size * baseRowsPerThread * words);
+        MPI_Recv(finalRows, remainderRows*words, MPI_UINT64_T, mpi_size-1, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
     }
     else if ((remainderRows != 0) && (mpi_rank == mpi_size-1)) {
-        int* finalRows = localNewBoard + (numRowsPerThread+1 * cols);
-        MPI_Send(finalRows, remainderRows*cols, MPI_INT, 0, 2, MPI_COMM_WORLD);
+        uint64_t* finalRows = localNewBoard + ((baseRowsPerThread+1) * pitch) + 1;
+        MPI_Send(finalRows, 1, remainderRowsType, 0, 2, MPI_COMM_WORLD);
     }
     
     // Print out final board
@@ -213,83 +190,74 @@ void runGameOfLife(int mpi_rank, int mpi_size, int* initialboard, int maxgen, in
         write_board(initialboard, rows, cols);
     }
     
+    MPI_Type_free(&baseRowsType);
+    MPI_Type_free(&remainderRowsType);
+    free(localNewBoard);
+    free(localOldBoard);
 }
 
-int* get_initial_board(int* rows, int* columns) {
-    int* board;
-    int i;
+uint64_t* get_initial_board(int* rows, int* columns) {
+    uint64_t* board;
+    int i, words, value;
     scanf("%d %d", rows, columns);
-    board = malloc(sizeof(int) * (*rows) * (*columns));
+    words = words_per_row(*columns);
+    board = calloc((size_t) (*rows) * words, sizeof(uint64_t));
     for (i = 0; i < (*rows) * (*columns); i++) {
-        scanf("%d", &(board[i]));
+        scanf("%d", &value);
+        if (value)
+            board[index1D(i / *columns, (i % *columns) / CELLS_PER_WORD, words)] |=
+                (uint64_t) 1 << ((i % *columns) % CELLS_PER_WORD);
     }
     return board;
 }
 
-void write_board(int* board, int rows, int columns) {
+void write_board(uint64_t* board, int rows, int columns) {
+    int words = words_per_row(columns);
     for (int i = 0; i < rows; i++) {
         for (int j = 0; j < columns; j++) {
-            printf("%d\t", board[index1D(i, j, columns)]);
+            printf("%d\t", (int) ((board[index1D(i, j / CELLS_PER_WORD, words)] >> (j % CELLS_PER_WORD)) & 1));
         }
         printf("\n");
     }
 }
 
-void generation(int* new_board, int* old_board, int rows, int columns) {
-    for (int i=0; i < rows; i++) {
-        for (int j=0; j < columns; j++) {
-            new_board[index1D(i, j, columns)] = next_value(old_board[index1D(i, j, columns)], count_neighbors(old_board, i, j, rows, columns));
-        }
-    }
+// sum three bit vectors: sum gets the ones bit, carry the twos bit
+static inline void full_add(uint64_t a, uint64_t b, uint64_t c, uint64_t* sum, uint64_t* carry) {
+    uint64_t half = a ^ b;
+    *sum = half ^ c;
+    *carry = (a & b) | (half & c);
 }
 
-int count_neighbors(int* board, int r, int c, int rows, int columns) {
-    int neighbors = 0;
-
-    // Top left
-    if (r != 0 && c != 0)
-       neighbors += board[index1D(r - 1, c - 1, columns)];
-    // Top middle
-    if (r != 0)
-       neighbors += board[index1D(r - 1, c, columns)];
-    // Top right
-    if (r != 0 && c != columns - 1)
-       neighbors += board[index1D(r - 1, c + 1, columns)];
-    // Middle left
-    if (c != 0)
-       neighbors += board[index1D(r, c - 1, columns)];
-    // Middle right
-    if (c != columns - 1)
-       neighbors += board[index1D(r, c + 1, columns)];
-    // Bottom left
-    if (r != rows - 1 && c != 0)
-       neighbors += board[index1D(r + 1, c - 1, columns)];
-    // Bottom middle 
-    if (r != rows - 1)
-       neighbors += board[index1D(r + 1, c, columns)];
-    // Bottom right 
-    if (r != rows - 1)
-       neighbors += board[index1D(r + 1, c + 1, columns)];
-
-    return neighbors;
-}
+void generation(uint64_t* new_board, uint64_t* old_board, int row_begin, int row_end, int words, uint64_t last_mask) {
+    int pitch = words + GUARD_WORDS;
+    for (int i = row_begin; i < row_end; i++) {
+        uint64_t* up = old_board + (i - 1) * pitch;
+        uint64_t* mid = old_board + i * pitch;
+        uint64_t* down = old_board + (i + 1) * pitch;
+        uint64_t* out = new_board + i * pitch;
+        for (int j = 1; j <= words; j++) {
+            // Left neighbours shift up a bit, right neighbours shift down a bit,
+            // borrowing the edge bit from the adjacent word
+            uint64_t up_l = (up[j] << 1) | (up[j - 1] >> 63);
+            uint64_t up_r = (up[j] >> 1) | (up[j + 1] << 63);
+            uint64_t mid_l = (mid[j] << 1) | (mid[j - 1] >> 63);
+            uint64_t mid_r = (mid[j] >> 1) | (mid[j + 1] << 63);
+            uint64_t down_l = (down[j] << 1) | (down[j - 1] >> 63);
+            uint64_t down_r = (down[j] >> 1) | (down[j + 1] << 63);
 
-int next_value(int cur_val, int neighbors) {
-   // Given a cell's current value (1 or 0) and its number of live
-   // neighbors (0-8), return its next value
-   assert(cur_val == 0 || cur_val == 1);
-   if (!(neighbors >= 0 && neighbors <= 8)) {
-    int rank = 0;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    printf("Rank = %d, Neighbors = %d\n", rank, neighbors);
-   }
-   
-   
-   assert(neighbors >= 0 && neighbors <= 8);
+            uint64_t up_ones, up_twos, down_ones, down_twos, ones, twos_a, twos_b, fours;
+            full_add(up_l, up[j], up_r, &up_ones, &up_twos);
+            full_add(down_l, down[j], down_r, &down_ones, &down_twos);
+            uint64_t mid_ones = mid_l ^ mid_r;
+            uint64_t mid_twos = mid_l & mid_r;
+            full_add(up_ones, mid_ones, down_ones, &ones, &twos_a);
+            full_add(up_twos, mid_twos, down_twos, &twos_b, &fours);
+            uint64_t twos = twos_a ^ twos_b;
+            fours |= twos_a & twos_b;
 
-   if (neighbors < 2) return 0;  // dies from isolation if alive
-   if (neighbors == 2) return cur_val; // keep current state
-   if (neighbors == 3) return 1; // survives if alive; spawns if dead
-   return 0;  // 4+ neighbors => dead
+            // Alive next if neighbors == 3, or neighbors == 2 and alive now
+            out[j] = twos & ~fours & (ones | mid[j]);
+        }
+        out[words] &= last_mask;
+    }
 }
-
@@ -0,0 +1,116 @@
+#!/bin/bash
+# Scaling benchmark for life.x. Boards are generated in memory on each rank
+# (--random), so nothing has to be read or piped in.
+#   ./life_bench.sh -n "1 2 4" -s "2048 4096" -g 200 -k "bitwise stencil" > results.csv
+#   ./life_bench.sh -m weak -f json > results.json
+#   ./life_bench.sh -c results.csv          # exits 1 on a regression
+# Strong scaling keeps an S x S board for every rank count; weak scaling
+# gives every rank S rows, an (S * ranks) x S board. Efficiency is against
+# the smallest rank count of the same kernel, size and generations. Each
+# point is the best of -r runs. Set MPIRUN to pass options to mpirun.
+
+life=./life.x
+ranks="1 2 4"
+sizes="1024 2048"
+generations="100"
+kernels="bitwise stencil"
+modes="strong weak"
+density=0.3
+repeats=3
+format=csv
+extra=""
+baseline=""
+tolerance=0.1
+mpirun=${MPIRUN:-mpirun}
+
+usage() {
+    echo "Usage: ./life_bench.sh [-x life.x] [-n ranks] [-s sizes] [-g generations] [-k kernels]"
+    echo "                       [-m strong|weak|both] [-d density] [-r repeats] [-f csv|json]"
+    echo "                       [-a 'life.x options'] [-c baseline.csv [-t tolerance]]"
+    exit 1
+}
+
+while getopts "x:n:s:g:k:m:d:r:f:a:c:t:" opt; do
+    case $opt in
+        x) life=$OPTARG ;;
+        n) ranks=$OPTARG ;;
+        s) sizes=$OPTARG ;;
+        g) generations=$OPTARG ;;
+        k) kernels=$OPTARG ;;
+        m) [ "$OPTARG" = both ] && modes="strong weak" || modes=$OPTARG ;;
+        d) density=$OPTARG ;;
+        r) repeats=$OPTARG ;;
+        f) format=$OPTARG ;;
+        a) extra=$OPTARG ;;
+        c) baseline=$OPTARG ;;
+        t) tolerance=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+[ "$format" = csv ] || [ "$format" = json ] || usage
+ranks=$(echo $ranks | tr ' ' '\n' | sort -n | tr '\n' ' ')
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+# best generations, compute and exchange seconds of repeats runs
+run() {
+    local n=$1 kernel=$2 rows=$3 columns=$4 gens=$5 best=""
+    for ((i = 0; i < repeats; i++)); do
+        $mpirun -np $n $life -k $kernel -r ${rows}x${columns} --density $density $extra \
+            -o "$scratch/board.bin" --timing $gens > /dev/null 2> "$scratch/err" || { cat "$scratch/err" >&2; return 1; }
+        local times=$(sed -n 's/.*generations \([0-9.]*\) s (compute \([0-9.]*\) s, exchange \([0-9.]*\) s).*/\1 \2 \3/p' "$scratch/err")
+        if [ -z "$best" ] || awk -v a="${times%% *}" -v b="${best%% *}" 'BEGIN { exit !(a < b) }'; then best=$times; fi
+    done
+    echo $best
+}
+
+header="mode,kernel,ranks,rows,columns,generations,seconds,compute,exchange,cell_updates_per_second,efficiency"
+results=()
+for mode in $modes; do
+    for kernel in $kernels; do
+        for size in $sizes; do
+            for gens in $generations; do
+                reference=""
+                for n in $ranks; do
+                    rows=$size
+                    [ "$mode" = weak ] && rows=$((size * n))
+                    times=$(run $n $kernel $rows $size $gens) || exit 1
+                    read seconds compute exchange <<< "$times"
+                    [ -z "$reference" ] && reference="$n $seconds"
+                    results+=("$(awk -v mode=$mode -v kernel=$kernel -v n=$n -v rows=$rows -v columns=$size \
+                        -v gens=$gens -v t=$seconds -v c=$compute -v e=$exchange -v ref="$reference" 'BEGIN {
+                        split(ref, r, " ")
+                        efficiency = mode == "strong" ? r[2] * r[1] / (t * n) : r[2] / t
+                        printf "%s,%s,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.4g,%.3f\n", mode, kernel, n, rows, columns,
+                               gens, t, c, e, (t > 0 ? rows * columns * gens / t : 0), efficiency }')")
+                done
+            done
+        done
+    done
+done
+
+if [ "$format" = csv ]; then
+    echo "$header"
+    printf "%s\n" "${results[@]}"
+else
+    printf "%s\n" "${results[@]}" | awk -F, -v header="$header" 'BEGIN { n = split(header, name, ","); print "[" }
+        { printf "%s  {", (NR > 1 ? ",\n" : "")
+          for (i = 1; i <= n; i++)
+              printf "%s\"%s\": %s", (i > 1 ? ", " : ""), name[i], (i <= 2 ? "\"" $i "\"" : $i)
+          printf "}" }
+        END { print "\n]" }'
+fi
+
+# a point is a regression when its cell updates per second fell more than
+# tolerance below the same point in the baseline
+if [ -n "$baseline" ]; then
+    printf "%s\n" "${results[@]}" | awk -F, -v tolerance=$tolerance '
+        NR == FNR { if (FNR > 1) rate[$1 FS $2 FS $3 FS $4 FS $5 FS $6] = $10; next }
+        { key = $1 FS $2 FS $3 FS $4 FS $5 FS $6
+          if (key in rate && $10 < (1 - tolerance) * rate[key]) {
+              printf "Regression: %s %s on %d ranks, %dx%d, %d generations: %.4g against %.4g cell updates/s\n",
+                     $1, $2, $3, $4, $5, $6, $10, rate[key] > "/dev/stderr"
+              failed = 1 } }
+        END { exit failed }' "$baseline" - || exit 1
+fi
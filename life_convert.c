@@ -0,0 +1,162 @@
+// Build: gcc -O2 life_convert.c -o life_convert
+// Converts a text board (the format life.x reads on stdin) into the binary
+// format life.x reads with --input, or back again with -d:
+//   ./life_convert < board.txt > board.bin
+//   ./life_convert -d < board.bin > board.txt
+// Only one row is held in memory at a time, so boards of any size convert.
+// It also lists the frames of a snapshot stream (life.x --snapshot), or
+// writes one of them out as a text board:
+//   ./life_convert -l < run.stream
+//   ./life_convert -s 3 < run.stream > board.txt
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+
+#define CELLS_PER_WORD 64
+
+// must match game_of_life.c
+#define BOARD_MAGIC "LIFEPACK"
+#define BOARD_ENCODING_PACKED64 1
+struct board_header {
+    char magic[8];
+    uint32_t encoding;
+    uint32_t reserved;
+    uint64_t rows, columns;
+};
+
+#define STREAM_MAGIC "LIFESTRM"
+#define STREAM_INDEX_MAGIC "LIFEINDX"
+#define STREAM_ENCODING_RLE64 1
+#define CHUNK_FIELDS 5
+
+// number of packed words needed for a row of columns cells
+uint64_t words_per_row(uint64_t columns) { return (columns + CELLS_PER_WORD - 1) / CELLS_PER_WORD; }
+
+// text -> binary; the words go out in host order, which is little-endian
+// on every machine we run on
+int encode() {
+    struct board_header header;
+    uint64_t* row;
+    uint64_t words;
+    int value;
+
+    memset(&header, 0, sizeof(header));
+    if (scanf("%lu %lu", &header.rows, &header.columns) != 2) {
+        fprintf(stderr, "Missing board size\n");
+        return 1;
+    }
+    memcpy(header.magic, BOARD_MAGIC, sizeof(header.magic));
+    header.encoding = BOARD_ENCODING_PACKED64;
+    fwrite(&header, sizeof(header), 1, stdout);
+
+    words = words_per_row(header.columns);
+    row = malloc(words * sizeof(uint64_t));
+    for (uint64_t i = 0; i < header.rows; i++) {
+        memset(row, 0, words * sizeof(uint64_t));
+        for (uint64_t j = 0; j < header.columns; j++) {
+            if (scanf("%d", &value) != 1) {
+                fprintf(stderr, "Board ends early at row %lu column %lu\n", i, j);
+                free(row);
+                return 1;
+            }
+            if (value) row[j / CELLS_PER_WORD] |= (uint64_t) 1 << (j % CELLS_PER_WORD);
+        }
+        fwrite(row, sizeof(uint64_t), words, stdout);
+    }
+    free(row);
+    return 0;
+}
+
+// binary -> text, in the same layout the text boards use
+int decode() {
+    struct board_header header;
+    uint64_t* row;
+    uint64_t words;
+
+    if (fread(&header, sizeof(header), 1, stdin) != 1 || memcmp(header.magic, BOARD_MAGIC, sizeof(header.magic)) != 0
+        || header.encoding != BOARD_ENCODING_PACKED64) {
+        fprintf(stderr, "Not a binary board\n");
+        return 1;
+    }
+    printf("%lu %lu\n", header.rows, header.columns);
+
+    words = words_per_row(header.columns);
+    row = malloc(words * sizeof(uint64_t));
+    for (uint64_t i = 0; i < header.rows; i++) {
+        if (fread(row, sizeof(uint64_t), words, stdin) != words) {
+            fprintf(stderr, "Board ends early at row %lu\n", i);
+            free(row);
+            return 1;
+        }
+        for (uint64_t j = 0; j < header.columns; j++)
+            printf(j + 1 < header.columns ? "%d " : "%d\n", (int) ((row[j / CELLS_PER_WORD] >> (j % CELLS_PER_WORD)) & 1));
+    }
+    free(row);
+    return 0;
+}
+
+// stream -> the frame list (frame < 0) or frame as a text board; the
+// stream has to be a file, as the index is read from its end
+int extract(long frame) {
+    struct board_header header;
+    uint64_t trailer[3], entry[3], frame_header[2], chunk[CHUNK_FIELDS];
+    uint32_t run[2];
+
+    if (fread(&header, sizeof(header), 1, stdin) != 1 || memcmp(header.magic, STREAM_MAGIC, sizeof(header.magic)) != 0
+        || header.encoding != STREAM_ENCODING_RLE64 || fseek(stdin, -(long) sizeof(trailer), SEEK_END) != 0
+        || fread(trailer, sizeof(trailer), 1, stdin) != 1 || memcmp(&trailer[2], STREAM_INDEX_MAGIC, 8) != 0) {
+        fprintf(stderr, "Not a complete snapshot stream\n");
+        return 1;
+    }
+    if (frame < 0) {
+        fseek(stdin, trailer[1], SEEK_SET);
+        printf("%lu x %lu, %lu frames\n", header.rows, header.columns, trailer[0]);
+        for (uint64_t i = 0; i < trailer[0] && fread(entry, sizeof(entry), 1, stdin) == 1; i++)
+            printf("frame %lu: generation %lu, %lu bytes\n", i, entry[0], entry[2]);
+        return 0;
+    }
+    if ((uint64_t) frame >= trailer[0]) {
+        fprintf(stderr, "The stream has %lu frames\n", trailer[0]);
+        return 1;
+    }
+    fseek(stdin, trailer[1] + frame * sizeof(entry), SEEK_SET);
+    if (fread(entry, sizeof(entry), 1, stdin) != 1 || fseek(stdin, entry[1], SEEK_SET) != 0
+        || fread(frame_header, sizeof(frame_header), 1, stdin) != 1) {
+        fprintf(stderr, "Frame %ld is unreadable\n", frame);
+        return 1;
+    }
+
+    // the chunks are the ranks' blocks, in no particular order
+    uint64_t words = words_per_row(header.columns);
+    uint64_t* board = calloc(header.rows * words, sizeof(uint64_t));
+    for (uint64_t c = 0; c < frame_header[1]; c++) {
+        if (fread(chunk, sizeof(chunk), 1, stdin) != 1) break;
+        uint64_t count = chunk[1] * chunk[3];
+        for (uint64_t w = 0; w < count; ) {
+            if (fread(run, sizeof(run), 1, stdin) != 1) break;
+            w += run[0];
+            for (uint32_t k = 0; k < run[1] && w < count; k++, w++) {
+                uint64_t* cell = board + (chunk[0] + w / chunk[3]) * words + chunk[2] + w % chunk[3];
+                if (fread(cell, sizeof(uint64_t), 1, stdin) != 1) break;
+            }
+        }
+    }
+    printf("%lu %lu\n", header.rows, header.columns);
+    for (uint64_t i = 0; i < header.rows; i++)
+        for (uint64_t j = 0; j < header.columns; j++)
+            printf(j + 1 < header.columns ? "%d " : "%d\n",
+                   (int) ((board[i * words + j / CELLS_PER_WORD] >> (j % CELLS_PER_WORD)) & 1));
+    free(board);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "-d") == 0) return decode();
+    if (argc == 2 && strcmp(argv[1], "-l") == 0) return extract(-1);
+    if (argc == 3 && strcmp(argv[1], "-s") == 0 && atol(argv[2]) >= 0) return extract(atol(argv[2]));
+    if (argc == 1) return encode();
+    printf("Usage: ./life_convert [-d | -l | -s frame] < input > output\n");
+    return 1;
+}
@@ -1,10 +1,109 @@
+// Build: mpicc -O3 -march=native -fopenmp pi_estimate_smith.c -o pi_smith.x
+// -march=native lets the throw loops use AVX2 or AVX-512 and -fopenmp
+// spreads them over each rank's cores; the count is the same without them.
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <mpi.h>
-#include <time.h>
 
-void runSequential(unsigned long long num_throws);
-void runMPIParallel(unsigned long long num_throws, int mpi_rank, int mpi_size);
+#define DEFAULT_SEED 1
+#define BATCH 1024	// throws generated into a buffer at a time
+#define CHUNK (1 << 20)	// throws taken from the shared counter at a time
+
+void runSequential(unsigned long long num_throws, uint64_t seed);
+void runMPIParallel(unsigned long long num_throws, int mpi_rank, int mpi_size, uint64_t seed);
+
+// Philox4x32-10 (Salmon et al., SC'11): a keyed bijection on a 128-bit
+// counter. Throw i always comes from counter i under the seed's key, so
+// every rank jumps straight to its own throws, no two ranks share a draw,
+// and the sequential and parallel counts agree exactly.
+static inline void philox(uint64_t counter, uint64_t seed, uint64_t* x, uint64_t* y) {
+	uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32), c2 = 0, c3 = 0;
+	uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+	for (int round = 0; round < 10; round++) {
+		uint64_t p0 = (uint64_t)0xD2511F53 * c0, p1 = (uint64_t)0xCD9E8D57 * c2;
+		uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c1 = (uint32_t)p1;
+		c3 = (uint32_t)p0;
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	*x = (uint64_t)c1 << 32 | c0;
+	*y = (uint64_t)c3 << 32 | c2;
+}
+
+// Fill x and y with the two 64-bit draws of throws first .. first + n - 1,
+// a SIMD lane per throw
+void fillThrows(uint64_t seed, unsigned long long first, int n, uint64_t* x, uint64_t* y) {
+	#pragma omp simd
+	for (int i = 0; i < n; i++) philox(first + i, seed, &x[i], &y[i]);
+}
+
+// The top 52 bits of a draw under the exponent of 1.0 make a double in
+// [1, 2), moved onto [-1, 1); this vectorizes without AVX-512
+static inline double coordinate(uint64_t draw) {
+	uint64_t bits = draw >> 12 | 0x3FF0000000000000ULL;
+	double unit;
+	memcpy(&unit, &bits, sizeof(unit));
+	return 2*unit - 3;
+}
+
+// Count throws first .. first + n - 1 in the circle: batches go to the
+// threads, and within a batch a SIMD lane per throw adds up the hits
+// without branches
+unsigned long long throwsInCircle(uint64_t seed, unsigned long long first, unsigned long long n) {
+	unsigned long long num_in_circle = 0, batches = (n + BATCH - 1) / BATCH;
+	#pragma omp parallel for schedule(static) reduction(+:num_in_circle)
+	for (unsigned long long b = 0; b < batches; b++) {
+		uint64_t x[BATCH], y[BATCH];
+		int batch = n - b*BATCH < BATCH ? (int)(n - b*BATCH) : BATCH, hits = 0;
+		fillThrows(seed, first + b*BATCH, batch, x, y);
+		#pragma omp simd reduction(+:hits)
+		for (int i = 0; i < batch; i++) {
+			double cx = coordinate(x[i]), cy = coordinate(y[i]);
+			hits += cx*cx + cy*cy <= 1;
+		}
+		num_in_circle += hits;
+	}
+	return num_in_circle;
+}
+// Throw throws 0 .. num_throws - 1 a chunk at a time, each rank taking the
+// next chunk from a counter on rank 0 with MPI_Fetch_and_op as soon as it
+// is done with the last, so faster ranks take more. Every throw is made
+// once whoever makes it, so the count matches the sequential one. Returns
+// this rank's hits and sets *share to the throws it made.
+unsigned long long dynamicThrows(uint64_t seed, unsigned long long num_throws, int mpi_rank,
+                                 unsigned long long* share) {
+	unsigned long long num_in_circle = 0, one = 1, chunk, *counter;
+	MPI_Win window;
+	MPI_Win_allocate(mpi_rank == 0 ? sizeof(unsigned long long) : 0, sizeof(unsigned long long),
+	                 MPI_INFO_NULL, MPI_COMM_WORLD, &counter, &window);
+	if (mpi_rank == 0) {
+		MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+		*counter = 0;
+		MPI_Win_unlock(0, window);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	*share = 0;
+	MPI_Win_lock_all(0, window);
+	for (;;) {
+		MPI_Fetch_and_op(&one, &chunk, MPI_UINT64_T, 0, 0, MPI_SUM, window);
+		MPI_Win_flush(0, window);
+		unsigned long long first = chunk * CHUNK;
+		if (first >= num_throws) break;
+		unsigned long long n = num_throws - first < CHUNK ? num_throws - first : CHUNK;
+		num_in_circle += throwsInCircle(seed, first, n);
+		*share += n;
+	}
+	MPI_Win_unlock_all(window);
+	MPI_Win_free(&window);
+	return num_in_circle;
+}
+
 /* Get number of throws from the user
  */
 unsigned long long int get_input() {
@@ -17,7 +116,9 @@ unsigned long long int get_input() {
 
 int main(int argc, char** argv) {
 	// Initialize MPI
-	MPI_Init(&argc, &argv);
+	// Threads only compute; MPI stays on the master thread
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
 	// Get MPI Rank and Size
 	int mpi_rank;
@@ -25,30 +126,36 @@ int main(int argc, char** argv) {
 	MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
 
-	// Run sequential for testing purposes
-	long long int num_throws = 0;
-	if (mpi_rank == 0) {
-		num_throws = get_input();
-		runSequential(num_throws);
+	// One seed (argv[1]) for every rank; anything but a whole number is
+	// refused rather than read as seed 0
+	uint64_t seed = DEFAULT_SEED;
+	if (argc > 1) {
+		char* end;
+		errno = 0;
+		seed = strtoull(argv[1], &end, 10);
+		if (argc > 2 || end == argv[1] || *end != '\0' || errno != 0 || strchr(argv[1], '-')) {
+			if (mpi_rank == 0) printf("Usage: ./pi_smith.x [seed]\n");
+			MPI_Finalize();
+			exit(1);
+		}
 	}
 
+	long long int num_throws = 0;
+	if (mpi_rank == 0) num_throws = get_input();
+
 	// Run MPI Parallel version
-	runMPIParallel(num_throws, mpi_rank, mpi_size);
+	runMPIParallel(num_throws, mpi_rank, mpi_size, seed);
+
+	// Run sequential for testing purposes, once the other ranks are done
+	if (mpi_rank == 0) runSequential(num_throws, seed);
 
+	MPI_Finalize();
 	return 0;
 }
 
-void runSequential(unsigned long long num_throws) {
-	unsigned long long num_in_circle = 0;
-	unsigned long long i;
-	double x, y, pi;
-
-	for (i=0; i < num_throws; i++) {
-		x = 2*((double)rand() / (double)RAND_MAX) - 1;
-		y = 2*((double)rand() / (double)RAND_MAX) - 1;
-
-		if (x*x + y*y <= 1) num_in_circle++;
-	}
+void runSequential(unsigned long long num_throws, uint64_t seed) {
+	unsigned long long num_in_circle = throwsInCircle(seed, 0, num_throws);
+	double pi;
 
 	printf("Sequential Total in circle: %llu out of %llu\n", num_in_circle, num_throws);
 	pi = (double)num_in_circle / (double) num_throws * 4;
@@ -56,46 +163,20 @@ void runSequential(unsigned long long num_throws) {
 
 }
 
-void runMPIParallel(unsigned long long num_throws, int mpi_rank, int mpi_size) {
+void runMPIParallel(unsigned long long num_throws, int mpi_rank, int mpi_size, uint64_t seed) {
 	if (mpi_rank == 0) printf("Start\n");
-	// Broadcast chunk of num_throws to processes
-	unsigned long long* num_throws_chunks = malloc(sizeof(unsigned long long));
-	(*num_throws_chunks) = num_throws / mpi_size;
-	unsigned long long remainder = num_throws % mpi_size;
-	if (mpi_rank == 0) printf("Calc'd chunks: %llu\n", *num_throws_chunks);
-
-	MPI_Bcast(num_throws_chunks, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	// Broadcast num_throws to processes
+	MPI_Bcast(&num_throws, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
 	if (mpi_rank == 0) printf("Broadcasted\n");
 
 	// Run in parallel
-	// Seed RNG
-	srand(time(NULL)*mpi_rank);
+	// Ranks pull chunks of throws until there are none left
 	unsigned long long* num_in_circle = malloc(sizeof(unsigned long long));;
-	*num_in_circle = 0;
-	unsigned long long i;
-	double x, y, pi;
+	unsigned long long my_share;
+	double pi;
 	if (mpi_rank == 0) printf("Seeded. Running\n");
-	if (mpi_rank == 0) { unsigned long long tempchunks = *num_throws_chunks;
-		printf("Chunk Size: %llu\n", tempchunks);
-	}
-	for (i=0; i < (*num_throws_chunks); i++) {
-		if (mpi_rank == 0) printf("i=%llu\n", i);
-		x = 2*((double)rand() / (double)RAND_MAX) - 1;
-		y = 2*((double)rand() / (double)RAND_MAX) - 1;
-
-		if (x*x + y*y <= 1) (*num_in_circle)++;
-	}
-	if (mpi_rank == 0) printf("Running Remainder\n");
-
-	// Run remainder on rank0 for uneven splits
-	if (mpi_rank == 0) {
-		for (i=0; i < remainder; i++) {
-			x = 2*((double)rand() / (double)RAND_MAX) - 1;
-			y = 2*((double)rand() / (double)RAND_MAX) - 1;
-
-			if (x*x + y*y <= 1) (*num_in_circle)++;
-		}
-	}
+	if (mpi_rank == 0) printf("Chunk Size: %d\n", CHUNK);
+	*num_in_circle = dynamicThrows(seed, num_throws, mpi_rank, &my_share);
 
 	if (mpi_rank == 0) printf("Making res\n");
 	// Reduce num_in_circle calculation
@@ -120,7 +201,16 @@ void runMPIParallel(unsigned long long num_throws, int mpi_rank, int mpi_size) {
 		free(num_in_circle_res);
 	}
 
+	// Report each rank's share of the throws
+	unsigned long long* shares = NULL;
+	if (mpi_rank == 0) shares = malloc(mpi_size * sizeof(unsigned long long));
+	MPI_Gather(&my_share, 1, MPI_UINT64_T, shares, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	if (mpi_rank == 0) {
+		for (int r = 0; r < mpi_size; r++)
+			printf("Rank %d share: %llu throws (%.1f%%)\n", r, shares[r], num_throws ? 100.0*shares[r] / num_throws : 0);
+		free(shares);
+	}
+
 	// Cleanup
 	free(num_in_circle);
-	free(num_throws_chunks);
 }